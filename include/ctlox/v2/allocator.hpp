@@ -0,0 +1,103 @@
+#pragma once
+
+#include <cstddef>
+#include <limits>
+#include <memory>
+#include <memory_resource>
+#include <new>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace ctlox::v2 {
+
+// Allocator of a program's runtime memory (see program_options_t::memory_resource_), which goes through
+// a caller-supplied memory resource, such as an arena which is freed at once after the program ends.
+// Without one, and always during constant evaluation, memory comes from std::allocator.
+template <typename T>
+class program_allocator {
+public:
+    using value_type = T;
+
+    constexpr program_allocator() noexcept = default;
+
+    constexpr program_allocator(std::pmr::memory_resource* resource) noexcept
+        : resource_(resource) { }
+
+    template <typename U>
+    constexpr program_allocator(const program_allocator<U>& other) noexcept
+        : resource_(other.resource()) { }
+
+    [[nodiscard]] constexpr T* allocate(std::size_t n) {
+        if !consteval {
+            if (resource_) {
+                if (n > std::numeric_limits<std::size_t>::max() / sizeof(T)) {
+                    throw std::bad_array_new_length();
+                }
+                return static_cast<T*>(resource_->allocate(n * sizeof(T), alignof(T)));
+            }
+        }
+        return std::allocator<T>().allocate(n);
+    }
+
+    constexpr void deallocate(T* p, std::size_t n) noexcept {
+        if !consteval {
+            if (resource_) {
+                resource_->deallocate(p, n * sizeof(T), alignof(T));
+                return;
+            }
+        }
+        std::allocator<T>().deallocate(p, n);
+    }
+
+    [[nodiscard]] constexpr std::pmr::memory_resource* resource() const noexcept { return resource_; }
+
+    friend constexpr bool operator==(const program_allocator& lhs, const program_allocator& rhs) noexcept {
+        return lhs.resource_ == rhs.resource_;
+    }
+
+private:
+    std::pmr::memory_resource* resource_ = nullptr;
+};
+
+template <typename T>
+using _program_vector = std::vector<T, program_allocator<T>>;
+
+using _program_string = std::basic_string<char, std::char_traits<char>, program_allocator<char>>;
+
+// Memory resource of the program running on this thread. Values don't know which program they belong
+// to, so the objects they allocate find it through here (see _new_object()).
+inline thread_local std::pmr::memory_resource* _thread_memory_resource = nullptr;
+
+// Allocator of the program running on this thread, which is std::allocator during constant evaluation.
+template <typename T>
+[[nodiscard]] constexpr program_allocator<T> _thread_allocator() noexcept {
+    if !consteval {
+        return program_allocator<T>(_thread_memory_resource);
+    }
+    return program_allocator<T>();
+}
+
+// Allocates from resource for the rest of the scope, on this thread.
+class _memory_resource_scope {
+public:
+    constexpr explicit _memory_resource_scope(std::pmr::memory_resource* resource) noexcept {
+        if !consteval {
+            previous_ = std::exchange(_thread_memory_resource, resource);
+        }
+    }
+
+    _memory_resource_scope(const _memory_resource_scope&) = delete;
+    _memory_resource_scope& operator=(const _memory_resource_scope&) = delete;
+
+    constexpr ~_memory_resource_scope() noexcept {
+        if !consteval {
+            _thread_memory_resource = previous_;
+        }
+    }
+
+private:
+    std::pmr::memory_resource* previous_ = nullptr;
+};
+
+}  // namespace ctlox::v2
\ No newline at end of file
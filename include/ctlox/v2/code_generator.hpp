@@ -1,6 +1,8 @@
 #pragma once
 
+#include <cassert>
 #include <chrono>
+#include <ctlox/v2/constant_pool.hpp>
 #include <ctlox/v2/environment.hpp>
 #include <ctlox/v2/exception.hpp>
 #include <ctlox/v2/expression.hpp>
@@ -11,8 +13,11 @@
 #include <ctlox/v2/resolver.hpp>
 #include <ctlox/v2/statement.hpp>
 #include <ctlox/v2/static_visit.hpp>
+#include <ctlox/v2/stats.hpp>
+#include <ctlox/v2/type_inference.hpp>
 
 #include <functional>
+#include <memory_resource>
 #include <print>
 
 namespace ctlox::v2 {
@@ -44,20 +49,46 @@ struct default_setup_fn {
 template <typename Fn>
 concept _setup_fn = std::invocable<Fn, environment*>;
 
+// Options of a generated program, passed after its setup function.
+struct program_options_t {
+    gc_options_t gc_;
+
+    // If set, receives the collector's statistics once the program ends, or fails.
+    gc_stats_t* gc_stats_ = nullptr;
+
+    // If set, the heap, the environments' variables and the objects of strings and functions are allocated
+    // from this resource, e.g. an arena dedicated to this run. It must outlive the program's call and any values
+    // kept from it, and is unused during constant evaluation. Characters of strings too long to be stored
+    // inline by std::string still come from its allocator.
+    std::pmr::memory_resource* memory_resource_ = nullptr;
+
+    // If set, receives the program's memory counters once it ends, or fails, see memory_stats_t.
+    memory_stats_t* memory_stats_ = nullptr;
+};
+
+// Generated expressions return either a value_t, or a const value_t& borrowed from a variable or
+// constant. Consumers which only inspect a value bind it as const value_t&, and only copy it
+// when it has to outlive the evaluation of another expression.
+template <bool borrow>
+using _read_t = std::conditional_t<borrow, const value_t&, value_t>;
+
+// Calls a function object whose callable is known, see code_generator::recursive_call_fn.
+using _direct_call_fn_t = value_t (*)(const _object_base*, const program_state_t&, std::span<const value_t>);
+
 struct _code_generator_base {
     static constexpr bool is_truthy(const value_t& value) {
         if (value.holds<nil_t>()) {
             return false;
         }
-        if (const bool* b = value.get_if<bool>()) {
+        if (auto b = value.get_if<bool>()) {
             return *b;
         }
         return true;
     }
 
     template <const token_t& oper>
-    static constexpr double& check_number_operand(value_t& value) {
-        if (double* number = value.get_if<double>()) {
+    static constexpr double check_number_operand(const value_t& value) {
+        if (auto number = value.get_if<double>()) {
             return *number;
         }
 
@@ -65,9 +96,9 @@ struct _code_generator_base {
     }
 
     template <const token_t& oper>
-    static constexpr std::pair<double&, double&> check_number_operands(value_t& lhs, value_t& rhs) {
-        double* lhs_number = lhs.get_if<double>();
-        double* rhs_number = rhs.get_if<double>();
+    static constexpr std::pair<double, double> check_number_operands(const value_t& lhs, const value_t& rhs) {
+        auto lhs_number = lhs.get_if<double>();
+        auto rhs_number = rhs.get_if<double>();
 
         if (lhs_number && rhs_number) {
             return { *lhs_number, *rhs_number };
@@ -76,6 +107,39 @@ struct _code_generator_base {
         throw runtime_error(oper, "Operands must be numbers.");
     }
 
+    // Checks the operand of a binary operator whose other operand is known to be a number.
+    template <const token_t& oper>
+    static constexpr double check_other_operand(const value_t& value) {
+        if (auto number = value.get_if<double>()) {
+            return *number;
+        }
+
+        if constexpr (oper.type_ == token_type::plus) {
+            throw runtime_error(oper, "Operands must be two numbers or two strings.");
+        } else {
+            throw runtime_error(oper, "Operands must be numbers.");
+        }
+    }
+
+    // Unboxes a value which type inference proved to be a number.
+    static constexpr double as_number(const value_t& value) {
+        auto number = value.get_if<double>();
+        assert(number);
+        return *number;
+    }
+
+    template <const token_t& oper>
+    static constexpr value_t add(const value_t& lhs, const value_t& rhs) {
+        if (auto [left, right] = std::pair(lhs.get_if<std::string>(), rhs.get_if<std::string>()); left && right) {
+            return *left + *right;
+        }
+        if (auto [left, right] = std::pair(lhs.get_if<double>(), rhs.get_if<double>()); left && right) {
+            return *left + *right;
+        }
+
+        throw runtime_error(oper, "Operands must be two numbers or two strings.");
+    }
+
     template <token_type type>
     static constexpr auto number_op_for() {
         if constexpr (type == token_type::less)
@@ -118,27 +182,68 @@ struct _code_generator_base {
 
     template <const literal_t& literal>
     static constexpr value_t materialize() {
-        return value_t(std::in_place_index<literal.index() - 1>, static_visit_v<literal>);
+        if constexpr (std::holds_alternative<std::string_view>(literal)) {
+            return value_t(std::string(static_visit_v<literal>));
+        } else {
+            return value_t(static_visit_v<literal>);
+        }
+    }
+
+    template <const auto& constants>
+    static constexpr auto intern_constants() {
+        std::array<value_t, constants.size()> values;
+        for (std::size_t i = 0; i < constants.size(); ++i) {
+            values[i] = value_t(std::string(constants.strings_[i]));
+        }
+        return values;
     }
 };
 
 template <const auto& ast, const auto& bindings>
     requires _flat_ast<decltype(ast)> && _bindings<decltype(bindings)>
 struct code_generator : _code_generator_base {
+    static constexpr _constant_pool auto constants = static_collect_constants<ast>();
+    static constexpr _types auto types = static_infer_types<ast>();
+
     static constexpr auto generate() {
         using root_block = visit_t<ast.root_block_>;
-        return []<_setup_fn SetupFn = default_setup_fn>(SetupFn&& setup_fn = {}) {
-            heap_t heap;
-            environment globals;
+        return []<_setup_fn SetupFn = default_setup_fn>(
+                   SetupFn&& setup_fn = {}, const program_options_t& options = {}) {
+            if (options.memory_stats_) {
+                *options.memory_stats_ = {};
+            }
+            const _memory_stats_scope stats_scope(options.memory_stats_);
+            const _memory_resource_scope resource_scope(options.memory_resource_);
+
+            heap_t heap(options.gc_, options.memory_resource_);
+            environment globals(&heap);
+            globals.declare_globals(bindings.globals_);
+            const auto constant_values = intern_constants<constants>();
 
-            globals.define_native<1>("println", default_println_fn {});
-            globals.define_native<0>("clock", default_clock_fn {});
+            globals.define_native<1, "println">(default_println_fn {});
+            globals.define_native<0, "clock">(default_clock_fn {});
 
             std::invoke(std::forward<SetupFn>(setup_fn), &globals);
 
-            program_state_t state(&heap, &globals);
+            program_state_t state(&heap, &globals, constant_values.data());
 
-            root_block {}(state);
+            const auto report = [&options, &heap] {
+                if (options.gc_stats_) {
+                    *options.gc_stats_ = heap.stats();
+                }
+                if (options.memory_stats_) {
+                    heap.report(*options.memory_stats_);
+                }
+            };
+
+            // Statistics are reported even if the program fails, for what it has cost until then.
+            try {
+                root_block {}(state);
+            } catch (...) {
+                report();
+                throw;
+            }
+            report();
         };
     }
 
@@ -197,14 +302,69 @@ private:
     template <auto v>
     using visit_t = decltype(visit<v>());
 
+    // Evaluates an expression which type inference proved to be a number to a plain double. Arithmetic on
+    // such numbers is generated without boxing its operands, other expressions are unboxed after evaluating.
+    template <flat_expr_ptr ptr>
+    static constexpr auto visit_number() {
+        static_assert(types.is_number(ptr));
+
+        if constexpr (
+            ast[ptr].template holds<flat_binary_expr>() || ast[ptr].template holds<flat_grouping_expr>()
+            || ast[ptr].template holds<flat_literal_expr>() || ast[ptr].template holds<flat_unary_expr>()) {
+            return generate_number<ptr, static_visit_v<ast[ptr]>>();
+        }
+
+        else {
+            using value = visit_t<ptr>;
+            return [](const program_state_t& state) static -> double { return as_number(value {}(state)); };
+        }
+    }
+
+    template <flat_expr_ptr ptr>
+    using visit_number_t = decltype(visit_number<ptr>());
+
+    // Evaluates the condition of an if or a while. Comparisons produce a bool directly, without boxing it.
+    template <flat_expr_ptr ptr>
+    static constexpr auto visit_condition() {
+        if constexpr (is_comparison(ptr)) {
+            return generate_comparison<ptr, static_visit_v<ast[ptr]>>();
+        }
+
+        else {
+            using condition = visit_t<ptr>;
+            return [](const program_state_t& state) static -> bool { return is_truthy(condition {}(state)); };
+        }
+    }
+
+    template <flat_expr_ptr ptr>
+    using visit_condition_t = decltype(visit_condition<ptr>());
+
     template <flat_stmt_ptr ptr, const flat_block_stmt& stmt>
     static constexpr auto generate_stmt() {
         using block = visit_t<stmt.statements_>;
-        return [](const program_state_t& state) static -> bool {
-            environment env(state.env_, state.heap_, bindings.find_scope_upvalues(ptr));
-            const program_state_t block_state = state.with(&env);
-            return block {}(block_state);
-        };
+        constexpr frame_t layout = bindings.find_frame(ptr);
+
+        if constexpr (!layout) {
+            return [](const program_state_t& state) static -> bool { return block {}(state); };
+        }
+
+        else if constexpr (layout.merged_) {
+            return [](const program_state_t& state) static -> bool {
+                const bool result = block {}(state);
+                state.env_->clear_block(layout);
+                return result;
+            };
+        }
+
+        else {
+            return [](const program_state_t& state) static -> bool {
+                environment::frame_storage<layout.values_size_, layout.upvalues_size_> frame;
+                environment::display_storage<layout.display_size_> display;
+                environment env(state.env_, state.heap_, frame, display);
+                const program_state_t block_state = state.with(&env);
+                return block {}(block_state);
+            };
+        }
     }
 
     template <flat_stmt_ptr, const flat_break_stmt& stmt>
@@ -224,33 +384,68 @@ private:
         };
     }
 
+    // The lox_function which a function statement defines.
     template <flat_stmt_ptr ptr, const flat_function_stmt& stmt>
-    static constexpr auto generate_stmt() {
+    static constexpr auto function_def() {
         using body = visit_t<stmt.body_>;
-        constexpr std::span<const token_t> params = ast.range(stmt.params_);
+        constexpr std::span<const declaration_t> params = bindings.find_params(ptr);
         constexpr std::span<const var_index_t> closure_upvales = bindings.find_closure_upvalues(ptr);
-        constexpr std::span<const var_index_t> scope_upvalues = bindings.find_scope_upvalues(ptr);
+        constexpr frame_t layout = bindings.find_frame(ptr);
+
+        return std::type_identity<lox_function<
+            stmt.name_.lexeme_,
+            params,
+            closure_upvales,
+            layout.values_size_,
+            layout.upvalues_size_,
+            body>> {};
+    }
 
-        using function_def = lox_function<stmt.name_.lexeme_, params, closure_upvales, scope_upvalues, body>;
+    template <flat_stmt_ptr ptr>
+    using function_def_t = typename decltype(function_def<ptr, static_visit_v<ast[ptr]>>())::type;
 
-        return [](const program_state_t& state) static -> bool {
-            // Workaround: predefine the name in case the function captures itself.
-            state.env_->define(stmt.name_.lexeme_, nil);
-            state.env_->assign(stmt.name_, function(function_def(state.env_)));
-            return true;
-        };
+    // Calls the lox_function defined at ptr. A function's own type can't be named while its body is being generated,
+    // which is where its recursive calls are. Unlike a constexpr function, this isn't usable in constant expressions,
+    // so it isn't instantiated until the end of the translation unit, once the whole program has been generated.
+    template <flat_stmt_ptr ptr>
+    static const _direct_call_fn_t recursive_call_fn;
+
+    template <flat_stmt_ptr ptr, const flat_function_stmt& stmt>
+    static constexpr auto generate_stmt() {
+        using function_def = function_def_t<ptr>;
+
+        using define = decltype(define_variable<ptr, stmt.name_>());
+
+        if constexpr (bindings.is_global_decl(ptr)) {
+            // Globals are never captured, so the function can be defined directly.
+            return [](const program_state_t& state) static -> bool {
+                define {}(state, function(function_def(state.env_)));
+                return true;
+            };
+        }
+
+        else {
+            constexpr var_index_t local = bindings.find_declaration(ptr);
+
+            return [](const program_state_t& state) static -> bool {
+                // Workaround: predefine the name in case the function captures itself.
+                define {}(state, nil);
+                state.env_->assign_at<local>(function(function_def(state.env_)));
+                return true;
+            };
+        }
     }
 
     template <flat_stmt_ptr, const flat_if_stmt& stmt>
     static constexpr auto generate_stmt() {
-        using condition = visit_t<stmt.condition_>;
+        using condition = visit_condition_t<stmt.condition_>;
         using then_branch = visit_t<stmt.then_branch_>;
 
         if constexpr (stmt.else_branch_ != flat_nullptr) {
             using else_branch = visit_t<stmt.else_branch_>;
 
             return [](const program_state_t& state) static -> bool {
-                if (is_truthy(condition {}(state))) {
+                if (condition {}(state)) {
                     return then_branch {}(state);
                 } else {
                     return else_branch {}(state);
@@ -260,7 +455,7 @@ private:
 
         else {
             return [](const program_state_t& state) static -> bool {
-                if (is_truthy(condition {}(state))) {
+                if (condition {}(state)) {
                     return then_branch {}(state);
                 } else {
                     return true;
@@ -287,19 +482,21 @@ private:
         }
     }
 
-    template <flat_stmt_ptr, const flat_var_stmt& stmt>
+    template <flat_stmt_ptr ptr, const flat_var_stmt& stmt>
     static constexpr auto generate_stmt() {
+        using define = decltype(define_variable<ptr, stmt.name_>());
+
         if constexpr (stmt.initializer_ != flat_nullptr) {
             using expr = visit_t<stmt.initializer_>;
             return [](const program_state_t& state) static -> bool {
-                state.env_->define(stmt.name_.lexeme_, expr {}(state));
+                define {}(state, expr {}(state));
                 return true;
             };
         }
 
         else {
             return [](const program_state_t& state) static -> bool {
-                state.env_->define(stmt.name_.lexeme_, nil);
+                define {}(state, nil);
                 return true;
             };
         }
@@ -307,7 +504,21 @@ private:
 
     template <flat_stmt_ptr, const flat_while_stmt& stmt>
     static constexpr auto generate_stmt() {
-        using condition = visit_t<stmt.condition_>;
+        if constexpr (is_counted_loop(stmt)) {
+            return generate_counted_loop<
+                static_visit_v<ast[stmt.condition_]>,
+                static_visit_v<ast[stmt.body_]>,
+                increment_of(static_visit_v<ast[stmt.body_]>)>();
+        }
+
+        else {
+            return generate_while<stmt>();
+        }
+    }
+
+    template <const flat_while_stmt& stmt>
+    static constexpr auto generate_while() {
+        using condition = visit_condition_t<stmt.condition_>;
         using body = visit_t<stmt.body_>;
 
         return [](const program_state_t& state) static -> bool {
@@ -315,7 +526,7 @@ private:
             const program_state_t loop_state = state.with(&break_slot);
 
             bool continue_execution = true;
-            while (continue_execution && is_truthy(condition {}(loop_state))) {
+            while (continue_execution && condition {}(loop_state)) {
                 continue_execution = body {}(loop_state);
             }
 
@@ -328,29 +539,255 @@ private:
         };
     }
 
+    // Matches the loop of a desugared `for (...; local op number; local = local +/- number) body`, where nothing
+    // else assigns to the local: its counter is then known to stay a number once it's been checked.
+    static constexpr bool is_counted_loop(const flat_while_stmt& stmt) {
+        if (!is_local_comparison(stmt.condition_))
+            return false;
+
+        const flat_expr_ptr counter = ast[stmt.condition_].template get_if<flat_binary_expr>()->left_;
+        const var_index_t local = bindings.find_local(counter);
+        if (local.captured_)
+            return false;
+
+        // The block holding the body and the increment declares nothing, so it has no environment of its own.
+        const flat_block_stmt* body = ast[stmt.body_].template get_if<flat_block_stmt>();
+        if (!body || body->statements_.empty() || bindings.find_frame(stmt.body_))
+            return false;
+
+        const flat_expression_stmt* last = ast[last_ptr(body->statements_)].template get_if<flat_expression_stmt>();
+        if (!last || !is_increment(last->expression_) || bindings.find_local(last->expression_) != local)
+            return false;
+
+        // The counter isn't captured, so besides the body, only functions which borrow it (see var_index_t) can
+        // assign to it. Those don't escape, so they can only be called by name, as locals: calling anything but
+        // a global might change the counter.
+        const std::string_view name = ast[counter].template get_if<flat_variable_expr>()->name_.lexeme_;
+        const flat_stmt_list rest { .first_ = body->statements_.first_, .last_ = last_ptr(body->statements_) };
+        return !any_expr(rest, [name](flat_expr_ptr ptr) {
+            if (const flat_assign_expr* assign = ast[ptr].template get_if<flat_assign_expr>())
+                return assign->name_.lexeme_ == name;
+            if (const flat_call_expr* call = ast[ptr].template get_if<flat_call_expr>())
+                return !ast[call->callee_].template holds<flat_variable_expr>() || bindings.find_local(call->callee_);
+            return false;
+        });
+    }
+
+    static constexpr flat_stmt_ptr last_ptr(flat_stmt_list list) { return list[list.size() - 1]; }
+
+    // Whether any expression held by statements satisfies pred, including within nested functions.
+    template <typename Pred>
+    static constexpr bool any_expr(flat_stmt_list list, Pred pred) {
+        for (flat_stmt_ptr stmt : list) {
+            if (any_expr(stmt, pred))
+                return true;
+        }
+        return false;
+    }
+
+    template <typename Pred>
+    static constexpr bool any_expr(flat_stmt_ptr ptr, Pred pred) {
+        const auto in_expr = [pred](flat_expr_ptr expr) { return expr != flat_nullptr && any_expr(expr, pred); };
+
+        return ast[ptr].visit([&]<typename Stmt>(const Stmt& stmt) {
+            if constexpr (std::same_as<Stmt, flat_block_stmt>)
+                return any_expr(stmt.statements_, pred);
+            else if constexpr (std::same_as<Stmt, flat_expression_stmt>)
+                return in_expr(stmt.expression_);
+            else if constexpr (std::same_as<Stmt, flat_function_stmt>)
+                return any_expr(stmt.body_, pred);
+            else if constexpr (std::same_as<Stmt, flat_if_stmt>)
+                return in_expr(stmt.condition_) || any_expr(stmt.then_branch_, pred)
+                    || (stmt.else_branch_ != flat_nullptr && any_expr(stmt.else_branch_, pred));
+            else if constexpr (std::same_as<Stmt, flat_return_stmt>)
+                return in_expr(stmt.value_);
+            else if constexpr (std::same_as<Stmt, flat_var_stmt>)
+                return in_expr(stmt.initializer_);
+            else if constexpr (std::same_as<Stmt, flat_while_stmt>)
+                return in_expr(stmt.condition_) || any_expr(stmt.body_, pred);
+            else
+                return false;
+        });
+    }
+
+    template <typename Pred>
+    static constexpr bool any_expr(flat_expr_ptr ptr, Pred pred) {
+        if (pred(ptr))
+            return true;
+
+        return ast[ptr].visit([pred]<typename Expr>(const Expr& expr) {
+            if constexpr (std::same_as<Expr, flat_assign_expr>)
+                return any_expr(expr.value_, pred);
+            else if constexpr (std::same_as<Expr, flat_binary_expr> || std::same_as<Expr, flat_logical_expr>)
+                return any_expr(expr.left_, pred) || any_expr(expr.right_, pred);
+            else if constexpr (std::same_as<Expr, flat_call_expr>) {
+                for (flat_expr_ptr argument : expr.arguments_) {
+                    if (any_expr(argument, pred))
+                        return true;
+                }
+                return any_expr(expr.callee_, pred);
+            }
+            else if constexpr (std::same_as<Expr, flat_grouping_expr>)
+                return any_expr(expr.expr_, pred);
+            else if constexpr (std::same_as<Expr, flat_unary_expr>)
+                return any_expr(expr.right_, pred);
+            else
+                return false;
+        });
+    }
+
+    static constexpr const flat_binary_expr& increment_of(const flat_block_stmt& body) {
+        const flat_stmt_t& last = ast[last_ptr(body.statements_)];
+        const flat_expr_ptr assign = last.template get_if<flat_expression_stmt>()->expression_;
+        return *ast[ast[assign].template get_if<flat_assign_expr>()->value_].template get_if<flat_binary_expr>();
+    }
+
+    // Superinstruction for counted loops: the counter is checked once, then kept as a double which is compared
+    // and incremented directly, and only stored to its variable for the body to read.
+    template <const flat_binary_expr& condition, const flat_block_stmt& body, const flat_binary_expr& increment>
+    static constexpr auto generate_counted_loop() {
+        constexpr flat_stmt_list rest { .first_ = body.statements_.first_, .last_ = last_ptr(body.statements_) };
+        using rest_block = visit_t<rest>;
+        using compare_op = decltype(number_op_for<condition.operator_.type_>());
+
+        constexpr var_index_t local = bindings.find_local(condition.left_);
+        constexpr double limit = number_literal(condition.right_);
+        constexpr double step = increment.operator_.type_ == token_type::plus
+            ? number_literal(increment.right_)
+            : -number_literal(increment.right_);
+
+        return [](const program_state_t& state) static -> bool {
+            break_slot break_slot;
+            const program_state_t loop_state = state.with(&break_slot);
+
+            double counter = number_operand<condition.left_, condition.operator_>(state.env_->get_at<local>());
+
+            bool continue_execution = true;
+            while (continue_execution && compare_op {}(counter, limit)) {
+                continue_execution = rest_block {}(loop_state);
+                if (continue_execution) {
+                    counter += step;
+                    state.env_->assign_at<local>(counter);
+                }
+            }
+
+            if (break_slot) {
+                continue_execution = true;
+            }
+            // if continue_execution is false for another reason, propagate
+
+            return continue_execution;
+        };
+    }
+
     template <flat_expr_ptr ptr, const flat_assign_expr& expr>
     static constexpr auto generate_expr() {
-        using right = visit_t<expr.value_>;
-        constexpr var_index_t local = bindings.find_local(ptr);
+        if constexpr (is_increment(ptr)) {
+            return generate_increment<ptr, static_visit_v<ast[expr.value_]>>();
+        }
 
-        if constexpr (local) {
-            return [](const program_state_t& state) static -> value_t {
-                value_t value = right {}(state);
-                state.env_->assign_at(local.env_depth_, local.env_index_, value);
-                return value;
-            };
+        else if constexpr (is_self_append<ptr, expr>()) {
+            return generate_self_append<ptr, expr, static_visit_v<ast[expr.value_]>>();
         }
 
         else {
+            using right = visit_t<expr.value_>;
+            using store = decltype(store_variable<ptr, expr.name_>());
+
             return [](const program_state_t& state) static -> value_t {
-                value_t value = right {}(state);
-                state.globals_->assign(expr.name_, value);
+                const value_t& value = right {}(state);
+                store {}(state, value);
                 return value;
             };
         }
     }
 
-    template <flat_expr_ptr, const flat_binary_expr& expr>
+    // Whether evaluating an expression can neither run Lox code nor assign to variables,
+    // so that values borrowed before evaluating it are still valid afterwards.
+    static constexpr bool is_pure(flat_expr_ptr ptr) {
+        return ast[ptr].visit([]<typename Expr>(const Expr& expr) {
+            if constexpr (std::same_as<Expr, flat_literal_expr> || std::same_as<Expr, flat_variable_expr>)
+                return true;
+            else if constexpr (std::same_as<Expr, flat_grouping_expr>)
+                return is_pure(expr.expr_);
+            else if constexpr (std::same_as<Expr, flat_unary_expr>)
+                return is_pure(expr.right_);
+            else if constexpr (std::same_as<Expr, flat_binary_expr> || std::same_as<Expr, flat_logical_expr>)
+                return is_pure(expr.left_) && is_pure(expr.right_);
+            else
+                return false;
+        });
+    }
+
+    // Matches `local = local + number` and `local = local - number`, where both names refer to the same variable.
+    static constexpr bool is_increment(flat_expr_ptr ptr) {
+        const flat_assign_expr* assign = ast[ptr].template get_if<flat_assign_expr>();
+        if (!assign || !bindings.find_local(ptr))
+            return false;
+
+        const flat_binary_expr* binary = ast[assign->value_].template get_if<flat_binary_expr>();
+        if (!binary || (binary->operator_.type_ != token_type::plus && binary->operator_.type_ != token_type::minus))
+            return false;
+
+        const flat_variable_expr* variable = ast[binary->left_].template get_if<flat_variable_expr>();
+        return variable && variable->name_.lexeme_ == assign->name_.lexeme_ && is_number_literal(binary->right_)
+            && bindings.find_local(binary->left_) == bindings.find_local(ptr);
+    }
+
+    // Superinstruction for incrementing a local by a constant, which reads and writes the variable in place.
+    template <flat_expr_ptr ptr, const flat_binary_expr& binary>
+    static constexpr auto generate_increment() {
+        constexpr var_index_t local = bindings.find_local(ptr);
+        constexpr double step = number_literal(binary.right_);
+
+        return [](const program_state_t& state) static -> value_t {
+            const double counter = number_operand<binary.left_, binary.operator_>(state.env_->get_at<local>());
+            const value_t value = binary.operator_.type_ == token_type::plus ? counter + step : counter - step;
+            state.env_->assign_at<local>(value);
+            return value;
+        };
+    }
+
+    // Matches `name = name + suffix`, where both names refer to the same variable.
+    template <flat_expr_ptr ptr, const flat_assign_expr& expr>
+    static constexpr bool is_self_append() {
+        const flat_binary_expr* binary = ast[expr.value_].template get_if<flat_binary_expr>();
+        if (!binary || binary->operator_.type_ != token_type::plus)
+            return false;
+
+        const flat_variable_expr* variable = ast[binary->left_].template get_if<flat_variable_expr>();
+        return variable && variable->name_.lexeme_ == expr.name_.lexeme_
+            && bindings.find_local(binary->left_) == bindings.find_local(ptr);
+    }
+
+    // Repeatedly appending to a string would copy the whole string every time. Instead, once the
+    // variable's own reference is dropped, a uniquely-owned string is appended to in place,
+    // which makes building a string up in a loop amortized O(1) per append.
+    template <flat_expr_ptr ptr, const flat_assign_expr& expr, const flat_binary_expr& binary>
+    static constexpr auto generate_self_append() {
+        using left = visit_t<binary.left_>;
+        using suffix = visit_t<binary.right_>;
+        using store = decltype(store_variable<ptr, expr.name_>());
+
+        return [](const program_state_t& state) static -> value_t {
+            value_t lhs = left {}(state);
+            value_t rhs = suffix {}(state);
+
+            if (auto string = rhs.get_if<std::string>(); string && lhs.holds<std::string>()) {
+                store {}(state, nil);
+                if (!lhs.append_if_unique(*string)) {
+                    lhs = *lhs.get_if<std::string>() + *string;
+                }
+            } else {
+                lhs = add<binary.operator_>(lhs, rhs);
+            }
+
+            store {}(state, lhs);
+            return lhs;
+        };
+    }
+
+    template <flat_expr_ptr ptr, const flat_binary_expr& expr>
     static constexpr auto generate_expr() {
         using left = visit_t<expr.left_>;
         using right = visit_t<expr.right_>;
@@ -359,47 +796,261 @@ private:
         using number_op = decltype(number_op_for<type>());
         using value_op = decltype(value_op_for<type>());
 
-        if constexpr (number_op {} != none) {
+        // The left operand may only be borrowed if evaluating the right operand can't invalidate it.
+        using lhs_t = _read_t<is_pure(expr.right_)>;
+
+        if constexpr (types.is_number(ptr)) {
+            using number = visit_number_t<ptr>;
+            return [](const program_state_t& state) static -> value_t { return number {}(state); };
+        }
+
+        else if constexpr (number_op {} != none) {
+            using operands = decltype(number_operands<expr>());
             return [](const program_state_t& state) static -> value_t {
-                value_t lhs = left {}(state);
-                value_t rhs = right {}(state);
-                auto [lhs_number, rhs_number] = check_number_operands<expr.operator_>(lhs, rhs);
-                return number_op {}(lhs_number, rhs_number);
+                const auto [lhs, rhs] = operands {}(state);
+                return number_op {}(lhs, rhs);
             };
         }
 
         else if constexpr (value_op {} != none) {
             return [](const program_state_t& state) static -> value_t {
-                value_t lhs = left {}(state);
-                value_t rhs = right {}(state);
+                lhs_t lhs = left {}(state);
+                const value_t& rhs = right {}(state);
                 return value_op {}(lhs, rhs);
             };
         }
 
         else if constexpr (type == token_type::plus) {
             return [](const program_state_t& state) static -> value_t {
-                value_t lhs = left {}(state);
-                value_t rhs = right {}(state);
+                lhs_t lhs = left {}(state);
+                const value_t& rhs = right {}(state);
+                return add<expr.operator_>(lhs, rhs);
+            };
+        }
 
-                if (auto [left, right] = std::pair(lhs.get_if<std::string>(), rhs.get_if<std::string>());
-                    left && right) {
-                    return *left + *right;
-                }
-                if (auto [left, right] = std::pair(lhs.get_if<double>(), rhs.get_if<double>()); left && right) {
-                    return *left + *right;
-                }
+        else {
+            static_assert(false, "Unexpected binary operator.");
+        }
+    }
+
+    static constexpr bool is_comparison(flat_expr_ptr ptr) {
+        const flat_binary_expr* binary = ast[ptr].template get_if<flat_binary_expr>();
+        if (!binary)
+            return false;
+
+        switch (binary->operator_.type_) {
+        case token_type::less:
+        case token_type::less_equal:
+        case token_type::greater:
+        case token_type::greater_equal:
+            return true;
+        default:
+            return false;
+        }
+    }
+
+    // Evaluates both operands of an arithmetic or comparison operator, in order, before checking that
+    // they're numbers; operands which type inference proved to be numbers are neither boxed nor checked.
+    template <const flat_binary_expr& expr>
+    static constexpr auto number_operands() {
+        constexpr bool left_number = types.is_number(expr.left_);
+        constexpr bool right_number = types.is_number(expr.right_);
+
+        if constexpr (left_number && right_number) {
+            using left = visit_number_t<expr.left_>;
+            using right = visit_number_t<expr.right_>;
 
-                throw runtime_error(expr.operator_, "Operands must be two numbers or two strings.");
+            return [](const program_state_t& state) static -> std::pair<double, double> {
+                const double lhs = left {}(state);
+                return { lhs, right {}(state) };
+            };
+        }
+
+        else if constexpr (left_number) {
+            using left = visit_number_t<expr.left_>;
+            using right = visit_t<expr.right_>;
+
+            return [](const program_state_t& state) static -> std::pair<double, double> {
+                const double lhs = left {}(state);
+                return { lhs, check_other_operand<expr.operator_>(right {}(state)) };
+            };
+        }
+
+        else if constexpr (right_number) {
+            using left = visit_t<expr.left_>;
+            using right = visit_number_t<expr.right_>;
+            using lhs_t = _read_t<is_pure(expr.right_)>;
+
+            return [](const program_state_t& state) static -> std::pair<double, double> {
+                lhs_t lhs = left {}(state);
+                const double rhs = right {}(state);
+                return { check_other_operand<expr.operator_>(lhs), rhs };
             };
         }
 
         else {
-            static_assert(false, "Unexpected binary operator.");
+            using left = visit_t<expr.left_>;
+            using right = visit_t<expr.right_>;
+            using lhs_t = _read_t<is_pure(expr.right_)>;
+
+            return [](const program_state_t& state) static -> std::pair<double, double> {
+                lhs_t lhs = left {}(state);
+                const value_t& rhs = right {}(state);
+                return check_number_operands<expr.operator_>(lhs, rhs);
+            };
+        }
+    }
+
+    static constexpr bool is_number_literal(flat_expr_ptr ptr) {
+        const flat_literal_expr* literal = ast[ptr].template get_if<flat_literal_expr>();
+        return literal && std::holds_alternative<double>(literal->value_);
+    }
+
+    static constexpr double number_literal(flat_expr_ptr ptr) {
+        return std::get<double>(ast[ptr].template get_if<flat_literal_expr>()->value_);
+    }
+
+    // Matches `local op number`, comparing a local variable against a number literal.
+    static constexpr bool is_local_comparison(flat_expr_ptr ptr) {
+        if (!is_comparison(ptr))
+            return false;
+
+        const flat_binary_expr* binary = ast[ptr].template get_if<flat_binary_expr>();
+        return ast[binary->left_].template holds<flat_variable_expr>() && bindings.find_local(binary->left_)
+            && is_number_literal(binary->right_);
+    }
+
+    // Checks the operand of a binary operator whose other operand is a number, unless it's proven to be one too.
+    template <flat_expr_ptr operand, const token_t& oper>
+    static constexpr double number_operand(const value_t& value) {
+        if constexpr (types.is_number(operand)) {
+            return as_number(value);
+        } else {
+            return check_other_operand<oper>(value);
+        }
+    }
+
+    template <flat_expr_ptr ptr, const flat_binary_expr& expr>
+    static constexpr auto generate_comparison() {
+        using number_op = decltype(number_op_for<expr.operator_.type_>());
+
+        // Superinstruction for comparing a local against a number literal, as in loop conditions.
+        if constexpr (is_local_comparison(ptr)) {
+            constexpr var_index_t local = bindings.find_local(expr.left_);
+            constexpr double limit = number_literal(expr.right_);
+
+            return [](const program_state_t& state) static -> bool {
+                return number_op {}(number_operand<expr.left_, expr.operator_>(state.env_->get_at<local>()), limit);
+            };
+        }
+
+        else {
+            using operands = decltype(number_operands<expr>());
+
+            return [](const program_state_t& state) static -> bool {
+                const auto [lhs, rhs] = operands {}(state);
+                return number_op {}(lhs, rhs);
+            };
+        }
+    }
+
+    template <flat_expr_ptr, const flat_binary_expr& expr>
+    static constexpr auto generate_number() {
+        using operands = decltype(number_operands<expr>());
+        using number_op = decltype(number_op_for<expr.operator_.type_>());
+
+        return [](const program_state_t& state) static -> double {
+            const auto [lhs, rhs] = operands {}(state);
+            if constexpr (expr.operator_.type_ == token_type::plus) {
+                return lhs + rhs;
+            } else {
+                return number_op {}(lhs, rhs);
+            }
+        };
+    }
+
+    template <flat_expr_ptr, const flat_grouping_expr& expr>
+    static constexpr auto generate_number() {
+        return visit_number<expr.expr_>();
+    }
+
+    template <flat_expr_ptr, const flat_literal_expr& expr>
+    static constexpr auto generate_number() {
+        return [](const program_state_t&) static -> double { return std::get<double>(expr.value_); };
+    }
+
+    template <flat_expr_ptr, const flat_unary_expr& expr>
+    static constexpr auto generate_number() {
+        static_assert(expr.operator_.type_ == token_type::minus);
+
+        if constexpr (types.is_number(expr.right_)) {
+            using right = visit_number_t<expr.right_>;
+            return [](const program_state_t& state) static -> double { return -right {}(state); };
+        }
+
+        else {
+            using right = visit_t<expr.right_>;
+            return [](const program_state_t& state) static -> double {
+                return -check_number_operand<expr.operator_>(right {}(state));
+            };
         }
     }
 
     template <flat_expr_ptr, const flat_call_expr& expr>
     static constexpr auto generate_expr() {
+        constexpr direct_call_t call = bindings.find_direct_call(expr.callee_);
+
+        if constexpr (call.function_ != flat_nullptr) {
+            return generate_direct_call<expr, call, static_visit_v<ast[call.function_]>>();
+        }
+
+        else {
+            return generate_call<expr>();
+        }
+    }
+
+    // The function a direct call calls is known (see direct_call_t), as is its arity. It's borrowed from its variable,
+    // which nothing can reassign, and called without checking its type, or its arity at runtime.
+    template <const flat_call_expr& expr, direct_call_t call, const flat_function_stmt& function_stmt>
+    static constexpr auto generate_direct_call() {
+        using callee_fn = visit_t<expr.callee_>;
+        using arguments_fn = visit_t<expr.arguments_>;
+
+        if constexpr (expr.arguments_.size() != function_stmt.params_.size()) {
+            return [](const program_state_t& state) static -> value_t {
+                callee_fn {}(state);
+                arguments_fn {}(state);
+                throw runtime_error(expr.paren_, "Incorrect argument count.");
+            };
+        }
+
+        // Recursive calls can't name the function's type (see recursive_call_fn), which can't be used during
+        // constant evaluation: there, they go through the function's implementation instead.
+        else if constexpr (call.recursive_) {
+            return [](const program_state_t& state) static -> value_t {
+                const _object_base* object = callee_fn {}(state).function_object();
+                const auto arguments = arguments_fn {}(state);
+                if consteval {
+                    return (*static_cast<const _function_impl_base*>(object))(state, std::span(arguments));
+                } else {
+                    return recursive_call_fn<call.function_>(object, state, std::span(arguments));
+                }
+            };
+        }
+
+        else {
+            using function_def = function_def_t<call.function_>;
+
+            return [](const program_state_t& state) static -> value_t {
+                const function_def& fn = _callable_of<function_def>(callee_fn {}(state).function_object());
+                const auto arguments = arguments_fn {}(state);
+                return fn(state, std::span(arguments));
+            };
+        }
+    }
+
+    template <const flat_call_expr& expr>
+    static constexpr auto generate_call() {
         using callee_fn = visit_t<expr.callee_>;
         using arguments_fn = visit_t<expr.arguments_>;
 
@@ -407,7 +1058,7 @@ private:
             value_t callee = callee_fn {}(state);
             const auto arguments = arguments_fn {}(state);
 
-            function* fn = callee.get_if<function>();
+            auto fn = callee.get_if<function>();
 
             if (!fn) {
                 throw runtime_error(expr.paren_, "Can only call functions and classes.");
@@ -430,7 +1081,14 @@ private:
     static constexpr auto generate_expr() {
         static_assert(!std::holds_alternative<none_t>(expr.value_));
 
-        return [](const program_state_t&) static -> value_t { return materialize<expr.value_>(); };
+        if constexpr (std::holds_alternative<std::string_view>(expr.value_)) {
+            constexpr std::size_t index = constants.index_of(static_visit_v<expr.value_>);
+            static_assert(index < constants.size());
+
+            return [](const program_state_t& state) static -> const value_t& { return state.constants_[index]; };
+        } else {
+            return [](const program_state_t&) static -> value_t { return materialize<expr.value_>(); };
+        }
     }
 
     template <flat_expr_ptr, const flat_logical_expr& expr>
@@ -442,7 +1100,7 @@ private:
         static_assert(short_cirtuit_op {} != none, "Unexpected logical operator.");
 
         return [](const program_state_t& state) static -> value_t {
-            value_t lhs = left {}(state);
+            const value_t& lhs = left {}(state);
 
             if (short_cirtuit_op {}(lhs))
                 return lhs;
@@ -451,25 +1109,17 @@ private:
         };
     }
 
-    template <flat_expr_ptr, const flat_unary_expr& expr>
+    template <flat_expr_ptr ptr, const flat_unary_expr& expr>
     static constexpr auto generate_expr() {
         using right = visit_t<expr.right_>;
 
         if constexpr (expr.operator_.type_ == token_type::bang) {
-            return [](const program_state_t& state) static -> value_t {
-                value_t value = right {}(state);
-                value = !is_truthy(value);
-                return value;
-            };
+            return [](const program_state_t& state) static -> value_t { return !is_truthy(right {}(state)); };
         }
 
         else if constexpr (expr.operator_.type_ == token_type::minus) {
-            return [](const program_state_t& state) static -> value_t {
-                value_t value = right {}(state);
-                double& number = check_number_operand<expr.operator_>(value);
-                number = -number;
-                return value;
-            };
+            using number = visit_number_t<ptr>;
+            return [](const program_state_t& state) static -> value_t { return number {}(state); };
         }
 
         else {
@@ -487,17 +1137,71 @@ private:
         constexpr var_index_t local = bindings.find_local(ptr);
 
         if constexpr (local) {
-            return [](const program_state_t& state) static -> value_t {
-                return state.env_->get_at(local.env_depth_, local.env_index_);
+            return [](const program_state_t& state) static -> const value_t& {
+                return state.env_->get_at<local>();
             };
         }
 
         else {
-            return [](const program_state_t& state) static -> value_t { return state.globals_->get(name); };
+            constexpr int global = bindings.find_global(name.lexeme_);
+            static_assert(global >= 0);
+
+            return [](const program_state_t& state) static -> const value_t& {
+                return state.globals_->get_global(global, name);
+            };
+        }
+    }
+
+    template <flat_expr_ptr ptr, const token_t& name>
+    static constexpr auto store_variable() {
+        constexpr var_index_t local = bindings.find_local(ptr);
+
+        if constexpr (local) {
+            return [](const program_state_t& state, const value_t& value) static {
+                state.env_->assign_at<local>(value);
+            };
+        }
+
+        else {
+            constexpr int global = bindings.find_global(name.lexeme_);
+            static_assert(global >= 0);
+
+            return [](const program_state_t& state, const value_t& value) static {
+                state.globals_->assign_global(global, name, value);
+            };
+        }
+    }
+
+    template <flat_stmt_ptr ptr, const token_t& name>
+    static constexpr auto define_variable() {
+        if constexpr (bindings.is_global_decl(ptr)) {
+            constexpr int global = bindings.find_global(name.lexeme_);
+            static_assert(global >= 0);
+
+            return [](const program_state_t& state, const value_t& value) static {
+                state.globals_->define_global(global, value);
+            };
+        }
+
+        else {
+            constexpr var_index_t local = bindings.find_declaration(ptr);
+            static_assert(local);
+
+            return [](const program_state_t& state, const value_t& value) static {
+                state.env_->define_at<local>(value);
+            };
         }
     }
 };
 
+template <const auto& ast, const auto& bindings>
+    requires _flat_ast<decltype(ast)> && _bindings<decltype(bindings)>
+template <flat_stmt_ptr ptr>
+const _direct_call_fn_t code_generator<ast, bindings>::recursive_call_fn =
+    [](const _object_base* object, const program_state_t& state, std::span<const value_t> arguments) -> value_t {
+        return _callable_of<function_def_t<ptr>>(object)(state, arguments);
+    };
+
 template <const auto& ast, const auto& locals>
 constexpr auto generate_code() {
     return code_generator<ast, locals>::generate();
@@ -0,0 +1,69 @@
+#pragma once
+
+#include <ctlox/v2/expression.hpp>
+#include <ctlox/v2/flat_ast.hpp>
+#include <ctlox/v2/literal.hpp>
+
+#include <algorithm>
+#include <array>
+#include <cstddef>
+#include <string_view>
+#include <variant>
+#include <vector>
+
+namespace ctlox::v2 {
+
+// The distinct string literals of a program. Each program run interns them once into value_t's,
+// so that evaluating a string literal only copies a handle.
+template <typename Strings>
+struct basic_constant_pool {
+    using constant_pool_tag = void;
+
+    [[nodiscard]] constexpr std::size_t size() const noexcept { return strings_.size(); }
+
+    [[nodiscard]] constexpr std::size_t index_of(std::string_view string) const noexcept {
+        return std::ranges::find(strings_, string) - strings_.begin();
+    }
+
+    Strings strings_;
+};
+
+template <typename P>
+concept _constant_pool = requires { typename std::remove_reference_t<P>::constant_pool_tag; };
+
+using constant_pool_t = basic_constant_pool<std::vector<std::string_view>>;
+
+template <std::size_t K>
+using static_constant_pool_t = basic_constant_pool<std::array<std::string_view, K>>;
+
+template <const auto& ast>
+constexpr constant_pool_t collect_constants() {
+    constant_pool_t pool;
+
+    for (const flat_expr_t& expr : ast.expressions_) {
+        const auto* literal = expr.get_if<flat_literal_expr>();
+        if (!literal)
+            continue;
+
+        const auto* string = std::get_if<std::string_view>(&literal->value_);
+        if (string && std::ranges::find(pool.strings_, *string) == pool.strings_.end())
+            pool.strings_.push_back(*string);
+    }
+
+    return pool;
+}
+
+template <const auto& ast>
+constexpr _constant_pool auto static_collect_constants() {
+    constexpr std::size_t K = collect_constants<ast>().size();
+
+    return [] {
+        constant_pool_t pool = collect_constants<ast>();
+
+        static_constant_pool_t<K> static_pool;
+        std::ranges::copy(pool.strings_, static_pool.strings_.begin());
+        return static_pool;
+    }();
+}
+
+}  // namespace ctlox::v2
\ No newline at end of file
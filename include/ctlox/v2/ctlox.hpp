@@ -5,6 +5,8 @@
 #include <ctlox/v2/scanner.hpp>
 #include <ctlox/v2/parser.hpp>
 #include <ctlox/v2/serializer.hpp>
+#include <ctlox/v2/folder.hpp>
+#include <ctlox/v2/pruner.hpp>
 #include <ctlox/v2/resolver.hpp>
 #include <ctlox/v2/code_generator.hpp>
 // clang-format on
@@ -14,7 +16,11 @@ namespace ctlox::v2 {
 template <string source>
 constexpr auto compile() {
     constexpr auto generate_ast = [] { return parse(scan(source)); };
-    static constexpr _flat_ast auto ast = static_serialize<generate_ast>();
+    static constexpr _flat_ast auto serialized_ast = static_serialize<generate_ast>();
+    // Checked before folding and pruning, which both remove code.
+    static_assert(static_check<serialized_ast>());
+    static constexpr _flat_ast auto folded_ast = static_fold<serialized_ast>();
+    static constexpr _flat_ast auto ast = static_prune<folded_ast>();
     static constexpr _bindings auto bindings = static_resolve<ast>();
     return generate_code<ast, bindings>();
 }
@@ -1,11 +1,22 @@
 #pragma once
 
+#include <ctlox/v2/allocator.hpp>
 #include <ctlox/v2/exception.hpp>
 #include <ctlox/v2/native_function.hpp>
 #include <ctlox/v2/resolver.hpp>
+#include <ctlox/v2/stats.hpp>
 #include <ctlox/v2/value.hpp>
 
+#include <algorithm>
+#include <array>
 #include <cassert>
+#include <chrono>
+#include <limits>
+#include <memory>
+#include <optional>
+#include <span>
+#include <string>
+#include <string_view>
 #include <utility>
 #include <vector>
 
@@ -13,16 +24,83 @@ namespace ctlox::v2 {
 
 struct shared_value_t;
 
+// Tuning of heap_t's collector, see heap_t::collect().
+struct gc_options_t {
+    // Number of live entries which starts a collection. After each one, this is raised to twice the survivors.
+    std::size_t threshold_ = 1024;
+
+    // Collections are incremental if this is non-zero: they are split into slices of at most this many entries
+    // and closures visited or values freed, one of which runs on every allocation until the collection is done.
+    // The trial deletion which finds the garbage isn't bounded: it must see counts that no mutation has touched,
+    // so it takes time proportional to the entries left unmarked and their closures. The garbage it finds is
+    // freed in slices after it, since nothing can reach it anymore.
+    std::size_t slice_budget_ = 0;
+
+    // If non-zero, slices also end once they have taken this long. Only measured at runtime, and like
+    // slice_budget_, doesn't bound trial deletion.
+    std::chrono::microseconds slice_time_budget_ {};
+};
+
+struct gc_stats_t {
+    std::size_t collections_ = 0;
+    std::size_t slices_ = 0;
+    std::size_t freed_ = 0;
+
+    // The longest slice, in entries and closures visited, and in time (only measured at runtime).
+    std::size_t longest_pause_work_ = 0;
+    std::chrono::nanoseconds longest_pause_ {};
+
+    // The longest trial deletion, which is part of a slice whatever its budget, see gc_options_t::slice_budget_.
+    std::size_t longest_trial_deletion_work_ = 0;
+};
+
+// Storage for captured variables, which are ref-counted. Entries which are only kept alive by reference
+// cycles, like a closure which captures itself, are freed by a tracing collector (see collect()) once
+// enough entries have been created since the last collection.
 class heap_t {
 public:
+    constexpr heap_t() noexcept = default;
+
+    // The heap's entries, and the environments created with it, are allocated with allocator.
+    constexpr explicit heap_t(const gc_options_t& options, const program_allocator<std::byte>& allocator = {}) noexcept
+        : entries_(allocator)
+        , options_(options)
+        , next_collection_(options.threshold_)
+        , objects_(allocator)
+        , pending_(allocator)
+        , garbage_(allocator) { }
+
+    heap_t(const heap_t&) = delete;
+    heap_t& operator=(const heap_t&) = delete;
+
     constexpr ~heap_t() noexcept;
 
     constexpr shared_value_t create(const value_t& value);
 
+    // Frees every entry which is only kept alive by reference cycles, finishing the collection in progress first.
+    constexpr void collect();
+
+    // Number of live entries, and the most there have been at once.
+    [[nodiscard]] constexpr std::size_t size() const noexcept { return size_; }
+    [[nodiscard]] constexpr std::size_t peak_size() const noexcept { return peak_size_; }
+
+    [[nodiscard]] constexpr const gc_stats_t& stats() const noexcept { return stats_; }
+
+    // Fills in the sizes of the heap, see memory_stats_t.
+    constexpr void report(memory_stats_t& stats) const noexcept {
+        stats.live_entries_ = size_;
+        stats.peak_entries_ = peak_size_;
+        stats.free_entries_ = entries_.size() - size_;
+    }
+
+    [[nodiscard]] constexpr program_allocator<std::byte> get_allocator() const noexcept {
+        return entries_.get_allocator();
+    }
+
 protected:
     friend shared_value_t;
 
-    constexpr value_t get(int index) const;
+    constexpr const value_t& get(int index) const;
     constexpr void assign(int index, const value_t& value);
 
     constexpr void acquire(int index) noexcept;
@@ -33,14 +111,147 @@ private:
         value_t value_;
         int count_ = 0;
         int next_index_ = -1;
+
+        // See _object_base::gc_refs_. Entries are marked if gc_epoch_ is the current collection's.
+        int gc_refs_ = 0;
+        unsigned gc_epoch_ = 0;
     };
 
-    std::vector<entry_t> entries_;
+    // Entries live in fixed-size chunks, which never move once allocated, so that growing the heap takes
+    // a bounded amount of time and doesn't move the values it holds. Freed entries are reused through the
+    // heap's free list (see entry_t::next_index_), and chunks are only freed with the heap.
+    class entry_storage_t {
+    public:
+        static constexpr std::size_t chunk_size = 256;
+
+        constexpr explicit entry_storage_t(const program_allocator<std::byte>& allocator = {}) noexcept
+            : chunks_(allocator) { }
+
+        entry_storage_t(const entry_storage_t&) = delete;
+        entry_storage_t& operator=(const entry_storage_t&) = delete;
+
+        constexpr ~entry_storage_t() noexcept { clear(); }
+
+        [[nodiscard]] constexpr std::size_t size() const noexcept { return size_; }
+
+        [[nodiscard]] constexpr entry_t& operator[](std::size_t index) noexcept {
+            return chunks_[index / chunk_size][index % chunk_size];
+        }
+        [[nodiscard]] constexpr const entry_t& operator[](std::size_t index) const noexcept {
+            return chunks_[index / chunk_size][index % chunk_size];
+        }
+
+        template <typename... Args>
+        constexpr void emplace_back(Args&&... args) {
+            if (size_ == chunks_.size() * chunk_size) {
+                entry_t* chunk = chunk_allocator().allocate(chunk_size);
+                try {
+                    chunks_.push_back(chunk);
+                } catch (...) {
+                    chunk_allocator().deallocate(chunk, chunk_size);
+                    throw;
+                }
+            }
+            std::construct_at(&(*this)[size_], std::forward<Args>(args)...);
+            ++size_;
+        }
+
+        constexpr void clear() noexcept {
+            for (std::size_t i = 0; i < size_; ++i) {
+                std::destroy_at(&(*this)[i]);
+            }
+            for (entry_t* chunk : chunks_) {
+                chunk_allocator().deallocate(chunk, chunk_size);
+            }
+            chunks_.clear();
+            size_ = 0;
+        }
+
+        [[nodiscard]] constexpr program_allocator<std::byte> get_allocator() const noexcept {
+            return chunks_.get_allocator();
+        }
+
+    private:
+        [[nodiscard]] constexpr program_allocator<entry_t> chunk_allocator() const noexcept {
+            return chunks_.get_allocator();
+        }
+
+        _program_vector<entry_t*> chunks_;
+        std::size_t size_ = 0;
+    };
+
+    // Steps of a collection, see collect().
+    enum class phase_t {
+        idle,
+        counting,
+        untracking,
+        rooting,
+        marking,
+        finishing,
+        releasing,
+    };
+
+    struct untrack_t final : _heap_tracer {
+        constexpr explicit untrack_t(heap_t* heap) noexcept
+            : heap_(heap) { }
+
+        constexpr void operator()(const shared_value_t& upvalue) override;
+
+        heap_t* heap_;
+    };
+
+    struct mark_t final : _heap_tracer {
+        constexpr explicit mark_t(heap_t* heap) noexcept
+            : heap_(heap) { }
+
+        constexpr void operator()(const shared_value_t& upvalue) override;
+
+        heap_t* heap_;
+    };
+
+    constexpr void begin_collection();
+    constexpr std::size_t step(std::size_t budget);
+    constexpr std::size_t finish_collection();
+    constexpr void end_collection();
+    constexpr void run_slice(std::size_t budget);
+
+    [[nodiscard]] constexpr bool is_marked(std::size_t index) const noexcept {
+        return entries_[index].gc_epoch_ == epoch_;
+    }
+    [[nodiscard]] constexpr bool is_candidate(std::size_t index) const noexcept {
+        return index < snapshot_size_ && entries_[index].count_ > 0 && !is_marked(index);
+    }
+
+    constexpr void mark_entry(std::size_t index);
+    constexpr void mark_object(_object_base* object);
+    constexpr void track(_object_base* object);
+    constexpr void release_tracked();
+
+    entry_storage_t entries_;
     int next_index_ = 0;
     bool destroying_ = false;
+
+    std::size_t size_ = 0;
+    std::size_t peak_size_ = 0;
+
+    gc_options_t options_;
+    gc_stats_t stats_;
+    std::size_t next_collection_ = options_.threshold_;
+
+    // State of the collection in progress.
+    phase_t phase_ = phase_t::idle;
+    unsigned epoch_ = 0;
+    std::size_t snapshot_size_ = 0;  // entries created since are allocated marked
+    std::size_t entry_cursor_ = 0;
+    std::size_t object_cursor_ = 0;
+    _program_vector<_object_base*> objects_;  // closures held by the heap, acquired until the collection ends
+    _program_vector<std::size_t> pending_;    // marked entries whose values haven't been traced yet
+    _program_vector<value_t> garbage_;        // values of unreachable entries, which are released in slices
 };
 
 struct shared_value_t {
+    constexpr shared_value_t() noexcept = default;
+
     constexpr shared_value_t(heap_t* heap, int index) noexcept
         : heap_(heap)
         , index_(index) {
@@ -84,205 +295,552 @@ struct shared_value_t {
         heap_->assign(index_, value);
     }
 
-    constexpr value_t get() const {
+    constexpr const value_t& get() const {
         assert(heap_);
         return heap_->get(index_);
     };
 
 private:
+    friend heap_t;
+
     heap_t* heap_ = nullptr;
     int index_ = -1;
 };
 
 constexpr heap_t::~heap_t() noexcept {
-    // The current implementation does not do garbage collection,
-    // so any cycles remain alive until the end of the program.
+    // Cycles which haven't been collected yet remain alive until the end of the program.
     destroying_ = true;
+    release_tracked();
+    garbage_.clear();
     entries_.clear();
 }
 
 constexpr shared_value_t heap_t::create(const value_t& value) {
+    _record_stats([](memory_stats_t& stats) { ++stats.creates_; });
+
+    if (phase_ == phase_t::idle && size_ >= next_collection_) {
+        begin_collection();
+    }
+    if (phase_ != phase_t::idle) {
+        run_slice(options_.slice_budget_ > 0 ? options_.slice_budget_ : std::numeric_limits<std::size_t>::max());
+    }
+
+    peak_size_ = std::max(peak_size_, ++size_);
+
     int index = next_index_;
     assert(index >= 0);
     if (index == entries_.size()) {
-        entries_.emplace_back(value, 1, -1);
+        entries_.emplace_back(value, 1, -1, 0, epoch_);
         ++next_index_;
     } else {
         entry_t& entry = entries_[index];
         assert(entry.count_ == 0);
         entry.value_ = value;
         entry.count_ = 1;
+        entry.gc_epoch_ = epoch_;
         next_index_ = std::exchange(entry.next_index_, -1);
     }
 
     return shared_value_t(this, index);
 }
 
-constexpr value_t heap_t::get(int index) const { return entries_[index].value_; }
-constexpr void heap_t::assign(int index, const value_t& value) { entries_[index].value_ = value; }
+constexpr const value_t& heap_t::get(int index) const { return entries_[index].value_; }
+
+constexpr void heap_t::assign(int index, const value_t& value) {
+    // Write barrier: a marked entry mustn't come to refer to entries which the collection won't mark.
+    if (phase_ != phase_t::idle && phase_ != phase_t::releasing && is_marked(index)) {
+        if (_object_base* object = value.function_object()) {
+            mark_object(object);
+        }
+    }
+
+    entries_[index].value_ = value;
+}
 
 constexpr void heap_t::acquire(int index) noexcept { entries_[index].count_++; }
 constexpr void heap_t::release(int index) noexcept {
     if (destroying_)
         return;
 
+    _record_stats([](memory_stats_t& stats) { ++stats.releases_; });
+
     auto& entry = entries_[index];
     if (--entry.count_ == 0) {
         entry.next_index_ = std::exchange(next_index_, index);
 
+        --size_;
+
         // Overwrite the value in case it holds upvalues itself.
         entry.value_ = nil;
     }
 }
 
-class environment {
-public:
-    // global environment
-    constexpr explicit environment() noexcept = default;
+// Mark-sweep collection by trial deletion: the roots are the entries and the closures which are referenced
+// from outside of the heap, by live environments and by closures held outside of it. They are found by
+// taking away the references from within the heap from each count, so the refcount fast path needs no
+// bookkeeping of its own.
+//
+// Incremental collections see counts at different times, and so only find candidates for collection: the
+// entries which remain unmarked. Trial deletion is then redone atomically over just the candidates, at a cost
+// proportional to their number, to find those which are really garbage. Those are freed in slices of their own.
+constexpr void heap_t::collect() {
+    constexpr std::size_t unbounded = std::numeric_limits<std::size_t>::max();
+    if (phase_ != phase_t::idle) {
+        run_slice(unbounded);
+    }
 
-    // non-global environment
-    constexpr explicit environment(environment* enclosing, heap_t* heap, std::span<const var_index_t> upvalues)
-        : enclosing_(enclosing)
-        , heap_(heap)
-        , upvalues_(upvalues) { }
+    begin_collection();
+    run_slice(unbounded);
+}
 
-    struct as_closure_tag { };
-    static constexpr as_closure_tag as_closure;
+constexpr void heap_t::begin_collection() {
+    assert(phase_ == phase_t::idle && objects_.empty() && pending_.empty());
+    phase_ = phase_t::counting;
+    ++epoch_;
+    snapshot_size_ = entries_.size();
+    entry_cursor_ = 0;
+    object_cursor_ = 0;
+}
 
-    // closure
-    constexpr explicit environment(
-        as_closure_tag, environment* env, std::span<const var_index_t> closure_upvalues) noexcept {
+// Does up to budget entries or closures worth of the collection in progress, and returns how many it did.
+constexpr std::size_t heap_t::step(std::size_t budget) {
+    std::size_t work = 0;
+    for (; work < budget && phase_ != phase_t::finishing && phase_ != phase_t::idle; ++work) {
+        switch (phase_) {
+        case phase_t::counting:
+            // Count the references to each entry, and to each closure from the heap.
+            if (entry_cursor_ < snapshot_size_) {
+                entry_t& entry = entries_[entry_cursor_++];
+                if (entry.count_ > 0) {
+                    entry.gc_refs_ = entry.count_;
+                    if (_object_base* object = entry.value_.function_object()) {
+                        track(object);
+                        --object->gc_refs_;
+                    }
+                }
+            } else {
+                phase_ = phase_t::untracking;
+            }
+            break;
 
-        for (const auto& [env_depth, env_index] : closure_upvalues) {
-            const variable_t& variable = env->ancestor(env_depth)->values_[env_index];
-            const shared_value_t* upvalue = std::get_if<shared_value_t>(&variable.value_);
-            assert(upvalue != nullptr);
+        case phase_t::untracking:
+            // Take away the references from the heap's closures to each entry.
+            if (object_cursor_ < objects_.size()) {
+                untrack_t untrack(this);
+                objects_[object_cursor_++]->trace(untrack);
+            } else {
+                phase_ = phase_t::rooting;
+                entry_cursor_ = 0;
+                object_cursor_ = 0;
+            }
+            break;
 
-            values_.emplace_back(variable.name_, *upvalue);
+        case phase_t::rooting:
+            if (object_cursor_ < objects_.size()) {
+                _object_base* object = objects_[object_cursor_++];
+                if (object->gc_refs_ > 0) {
+                    mark_object(object);
+                }
+            } else if (entry_cursor_ < snapshot_size_) {
+                const std::size_t index = entry_cursor_++;
+                if (entries_[index].count_ > 0 && entries_[index].gc_refs_ > 0) {
+                    mark_entry(index);
+                }
+            } else {
+                phase_ = phase_t::marking;
+            }
+            break;
+
+        case phase_t::marking:
+            if (!pending_.empty()) {
+                const std::size_t index = pending_.back();
+                pending_.pop_back();
+                if (_object_base* object = entries_[index].value_.function_object()) {
+                    mark_object(object);
+                }
+            } else {
+                phase_ = phase_t::finishing;
+            }
+            break;
+
+        case phase_t::releasing:
+            // Releasing an unreachable value frees its closure, and the entries which only it referred to,
+            // whose values have been taken out too. Unreachable entries can't change, so this is interruptible.
+            if (!garbage_.empty()) {
+                garbage_.pop_back();
+            } else {
+                end_collection();
+            }
+            break;
+
+        default:
+            assert(false);
         }
     }
+    return work;
+}
+
+// Trial deletion over the candidates left by the collection, see collect(), which takes out the values of those
+// which are garbage, to be released. Returns the work done, which isn't bounded by any budget: this has to run
+// atomically, since counts taken before a mutation can't be trusted after.
+constexpr std::size_t heap_t::finish_collection() {
+    assert(phase_ == phase_t::finishing && pending_.empty());
 
-    constexpr auto ancestor(this auto&& self, int env_depth) noexcept -> decltype(&self) {
-        auto* ancestor = &self;
-        for (int i = 0; i < env_depth; ++i)
-            ancestor = ancestor->enclosing_;
-        return ancestor;
+    // Counts seen so far may be stale, and so are the references held on closures for the collection.
+    release_tracked();
+
+    _program_vector<std::size_t> candidates(get_allocator());
+    for (std::size_t i = 0; i < snapshot_size_; ++i) {
+        if (is_candidate(i)) {
+            candidates.push_back(i);
+            entries_[i].gc_refs_ = entries_[i].count_;
+        }
     }
 
-    [[nodiscard]] constexpr value_t get(const token_t& name) const {
-        // non-capturing lambda to avoid unintentionally accessing this
-        auto do_get = [](const environment* env, const token_t& name) {
-            for (; env != nullptr; env = env->enclosing_) {
-                auto it = std::ranges::find(env->values_, name.lexeme_, &variable_t::name_);
-                if (it != env->values_.end()) {
-                    return get_impl(*it);
-                }
-            }
+    for (const std::size_t index : candidates) {
+        if (_object_base* object = entries_[index].value_.function_object()) {
+            track(object);
+            --object->gc_refs_;
+        }
+    }
 
-            throw runtime_error(name, "Undefined variable.");
-        };
+    untrack_t untrack(this);
+    for (const _object_base* object : objects_) {
+        object->trace(untrack);
+    }
 
-        return do_get(this, name);
+    // Candidates referenced from outside of the candidates are alive, and so is everything they refer to.
+    for (std::size_t i = 0; i < objects_.size(); ++i) {
+        if (objects_[i]->gc_refs_ > 0) {
+            mark_object(objects_[i]);
+        }
+    }
+    for (const std::size_t index : candidates) {
+        if (entries_[index].gc_refs_ > 0) {
+            mark_entry(index);
+        }
+    }
+    while (!pending_.empty()) {
+        const std::size_t index = pending_.back();
+        pending_.pop_back();
+        if (_object_base* object = entries_[index].value_.function_object()) {
+            mark_object(object);
+        }
     }
 
-    [[nodiscard]] constexpr value_t get_at(int env_depth, int env_index) const {
-        return get_impl(ancestor(env_depth)->values_[env_index]);
+    // Sweep: releasing the values of unreachable entries releases the closures they hold, and in turn
+    // the entries those refer to, which frees every entry of the cycles.
+    for (const std::size_t index : candidates) {
+        if (!is_marked(index)) {
+            garbage_.push_back(std::exchange(entries_[index].value_, nil));
+        }
     }
 
-    constexpr void define(std::string_view name, const value_t& value) {
-        const auto it = std::ranges::find(values_, name, &variable_t::name_);
-        if (it != values_.end()) {
-            assign_impl(*it, value);
+    const std::size_t work = candidates.size() + objects_.size();
+    release_tracked();
+
+    phase_ = phase_t::releasing;
+    stats_.freed_ += garbage_.size();
+    return work;
+}
+
+constexpr void heap_t::end_collection() {
+    assert(phase_ == phase_t::releasing && garbage_.empty());
+    phase_ = phase_t::idle;
+    next_collection_ = std::max(options_.threshold_, 2 * size_);
+    ++stats_.collections_;
+}
+
+// Runs a slice of the collection in progress, which finishes it if it gets that far.
+constexpr void heap_t::run_slice(std::size_t budget) {
+    using clock = std::chrono::steady_clock;
+
+    bool timed = false;
+    clock::time_point start {};
+    if !consteval {
+        timed = options_.slice_time_budget_.count() > 0;
+        start = clock::now();
+    }
+
+    // With a time budget, the clock is checked between chunks of work.
+    constexpr std::size_t chunk = 64;
+    std::size_t work = 0;
+    while (work < budget && phase_ != phase_t::idle) {
+        if (phase_ == phase_t::finishing) {
+            const std::size_t trial_deletion_work = finish_collection();
+            stats_.longest_trial_deletion_work_ = std::max(stats_.longest_trial_deletion_work_, trial_deletion_work);
+            work += trial_deletion_work;
         } else {
-            if (defining_upvalue()) {
-                values_.emplace_back(std::string(name), heap_->create(value));
-                defined_upvalue();
+            work += step(timed ? std::min(chunk, budget - work) : budget - work);
+        }
+        if !consteval {
+            if (timed && clock::now() - start >= options_.slice_time_budget_)
+                break;
+        }
+    }
+
+    ++stats_.slices_;
+    stats_.longest_pause_work_ = std::max(stats_.longest_pause_work_, work);
+    if !consteval {
+        stats_.longest_pause_ = std::max<std::chrono::nanoseconds>(stats_.longest_pause_, clock::now() - start);
+    }
+}
+
+constexpr void heap_t::mark_entry(std::size_t index) {
+    if (!is_marked(index)) {
+        entries_[index].gc_epoch_ = epoch_;
+        pending_.push_back(index);
+    }
+}
+
+constexpr void heap_t::mark_object(_object_base* object) {
+    track(object);
+    if (!std::exchange(object->gc_marked_, true)) {
+        mark_t mark(this);
+        object->trace(mark);
+    }
+}
+
+// Holds a reference to a closure for the rest of the collection, so that it can be counted and marked.
+constexpr void heap_t::track(_object_base* object) {
+    if (object->gc_refs_ < 0) {
+        object->gc_refs_ = object->count_;
+        object->acquire();
+        objects_.push_back(object);
+    }
+}
+
+constexpr void heap_t::release_tracked() {
+    for (_object_base* object : std::exchange(objects_, {})) {
+        object->gc_refs_ = -1;
+        object->gc_marked_ = false;
+        object->release();
+    }
+}
+
+constexpr void heap_t::untrack_t::operator()(const shared_value_t& upvalue) {
+    --heap_->entries_[upvalue.index_].gc_refs_;
+}
+
+constexpr void heap_t::mark_t::operator()(const shared_value_t& upvalue) { heap_->mark_entry(upvalue.index_); }
+
+class environment {
+    // Variables of a local environment. Captured variables live on the heap, so that closures
+    // can share them, and the others live directly in the frame. Closures have no values of their
+    // own, but can borrow them from the frames of the functions which don't escape.
+    struct frame_ref_t {
+        value_t* values_ = nullptr;
+        shared_value_t* upvalues_ = nullptr;
+        value_t* const* borrowed_ = nullptr;
+    };
+
+public:
+    // Storage for the variables of a local scope, sized by the resolver (see frame_t).
+    template <std::size_t Values, std::size_t Upvalues>
+    struct frame_storage {
+        std::array<value_t, Values> values_;
+        std::array<shared_value_t, Upvalues> upvalues_;
+    };
+
+    // Storage for the display of a local scope, sized by the resolver (see frame_t).
+    template <std::size_t N>
+    using display_storage = std::array<frame_ref_t, N>;
+
+    // global environment
+    constexpr explicit environment() noexcept = default;
+
+    // global environment, whose globals and closures are allocated with the heap's allocator.
+    constexpr explicit environment(heap_t* heap) noexcept
+        : heap_(heap)
+        , names_(heap->get_allocator())
+        , globals_(heap->get_allocator()) { }
+
+    // non-global environment, whose variables live in frame.
+    // The display holds the variables of this environment, followed by those of the enclosing
+    // environment's display, so that resolved locals are accessed without walking the chain.
+    template <std::size_t Values, std::size_t Upvalues>
+    constexpr explicit environment(
+        environment* enclosing,
+        heap_t* heap,
+        frame_storage<Values, Upvalues>& frame,
+        std::span<frame_ref_t> display)
+        : heap_(heap)
+        , display_(display) {
+        _record_stats([](memory_stats_t& stats) { ++stats.frames_; });
+
+        assert(!display_.empty());
+        display_[0] = { frame.values_.data(), frame.upvalues_.data() };
+
+        if (display_.size() > 1) {
+            if (enclosing->display_.empty()) {
+                // A function's closure, which is the only other environment it can refer to.
+                assert(display_.size() == 2);
+                display_[1] = { nullptr, enclosing->upvalues_.data(), enclosing->borrowed_.data() };
             } else {
-                values_.emplace_back(std::string(name), value);
+                assert(display_.size() - 1 <= enclosing->display_.size());
+                std::ranges::copy(enclosing->display_.first(display_.size() - 1), display_.begin() + 1);
             }
         }
     }
 
-    constexpr void assign(const token_t& name, const value_t& value) {
-        // non-capturing lambda to avoid unintentionally accessing this
-        auto do_assign = [](environment* env, const token_t& name, const value_t& value) {
-            for (; env != nullptr; env = env->enclosing_) {
-                auto it = std::ranges::find(env->values_, name.lexeme_, &variable_t::name_);
-                if (it != env->values_.end()) {
-                    assign_impl(*it, value);
-                    return;
-                }
-            }
+    environment(const environment&) = delete;
+    environment& operator=(const environment&) = delete;
+    constexpr environment(environment&&) noexcept = default;
+    constexpr environment& operator=(environment&&) noexcept = default;
 
-            throw runtime_error(name, "Undefined variable.");
-        };
+    struct as_closure_tag { };
+    static constexpr as_closure_tag as_closure;
 
-        do_assign(this, name, value);
+    // closure
+    constexpr explicit environment(
+        as_closure_tag, environment* env, std::span<const var_index_t> closure_upvalues)
+        : upvalues_(env->get_allocator())
+        , borrowed_(env->get_allocator()) {
+        _record_stats([](memory_stats_t& stats) { ++stats.frames_; });
+
+        for (const var_index_t& upvalue : closure_upvalues) {
+            const frame_ref_t& frame = env->display_[upvalue.env_depth_];
+            if (upvalue.captured_)
+                upvalues_.push_back(frame.upvalues_[upvalue.env_index_]);
+            else if (upvalue.borrowed_)
+                borrowed_.push_back(frame.borrowed_[upvalue.env_index_]);
+            else
+                borrowed_.push_back(&frame.values_[upvalue.env_index_]);
+        }
     }
 
-    constexpr void assign_at(int env_depth, int env_index, const value_t& value) {
-        assign_impl(ancestor(env_depth)->values_[env_index], value);
+    // Visits the upvalues of a closure, see heap_t::collect(). Borrowed values are part of the frames
+    // they're borrowed from, which are roots.
+    constexpr void trace(_heap_tracer& tracer) const {
+        for (const shared_value_t& upvalue : upvalues_) {
+            tracer(upvalue);
+        }
     }
 
-    template <int arity>
-    constexpr void define_native(std::string_view name, auto&& fn) {
-        assert(enclosing_ == nullptr && "native functions can only be defined at the global scope");
-        using Fn = decltype(fn);
-        using NativeFn = native_function<arity, std::decay_t<Fn>>;
-        define(name, function(NativeFn(name, std::forward<Fn>(fn))));
+    // Variables are read by reference, which stays valid until the variable is next
+    // assigned to, or until more variables are defined.
+    // Only globals are looked up by name, resolved locals are accessed with get_at().
+    [[nodiscard]] constexpr const value_t& get(const token_t& name) const {
+        return get_global(find_global(name), name);
     }
 
-private:
-    struct variable_t {
-        using value = std::variant<value_t, shared_value_t>;
+    template <var_index_t local>
+    [[nodiscard]] constexpr const value_t& get_at() const {
+        if constexpr (local.captured_)
+            return display_[local.env_depth_].upvalues_[local.env_index_].get();
+        else if constexpr (local.borrowed_)
+            return *display_[local.env_depth_].borrowed_[local.env_index_];
+        else
+            return display_[local.env_depth_].values_[local.env_index_];
+    }
 
-        std::string name_;
-        value value_;
-    };
+    // Declares the globals the resolver found, in order, so that the generated code can access them
+    // by index. This must be called before any other global is defined.
+    constexpr void declare_globals(std::span<const std::string_view> names) {
+        assert(display_.empty() && names_.empty());
+        for (std::string_view name : names) {
+            names_.emplace_back(name, names_.get_allocator());
+        }
+        globals_.resize(names.size());
+    }
 
-    static constexpr value_t get_impl(const variable_t& variable) {
-        if (const value_t* v = std::get_if<value_t>(&variable.value_)) {
-            return *v;
-        } else if (const shared_value_t* uv = std::get_if<shared_value_t>(&variable.value_)) {
-            return uv->get();
-        } else {
-            std::abort();
+    [[nodiscard]] constexpr const value_t& get_global(int index, const token_t& name) const {
+        const std::optional<value_t>& global = globals_[index];
+        if (!global) {
+            throw runtime_error(name, "Undefined variable.");
+        }
+        return *global;
+    }
+
+    constexpr void define_global(int index, const value_t& value) { globals_[index] = value; }
+
+    constexpr void assign_global(int index, const token_t& name, const value_t& value) {
+        std::optional<value_t>& global = globals_[index];
+        if (!global) {
+            throw runtime_error(name, "Undefined variable.");
         }
+        *global = value;
     }
 
-    static constexpr void assign_impl(variable_t& variable, const value_t& value) {
-        if (value_t* v = std::get_if<value_t>(&variable.value_)) {
-            *v = value;
-        } else if (shared_value_t* uv = std::get_if<shared_value_t>(&variable.value_)) {
-            uv->assign(value);
+    // Defines a global by name. Locals are defined with define_at(), in the slot the resolver gave them.
+    constexpr void define(std::string_view name, const value_t& value) {
+        assert(display_.empty() && "only globals can be defined by name");
+        if (const auto it = std::ranges::find(names_, name); it != names_.end()) {
+            define_global(static_cast<int>(std::distance(names_.begin(), it)), value);
         } else {
-            std::abort();
+            names_.emplace_back(name, names_.get_allocator());
+            globals_.emplace_back(value);
         }
     }
 
-    constexpr bool defining_upvalue() const {
-        if (upvalues_.empty())
-            return false;
+    template <var_index_t local>
+    constexpr void define_at(const value_t& value) {
+        static_assert(local.env_depth_ == 0 && !local.borrowed_);
+        if constexpr (local.captured_)
+            display_[0].upvalues_[local.env_index_] = heap_->create(value);
+        else
+            display_[0].values_[local.env_index_] = value;
+    }
 
-        return upvalues_[0].env_index_ == values_.size();
+    constexpr void assign(const token_t& name, const value_t& value) {
+        assign_global(find_global(name), name, value);
     }
 
-    constexpr void defined_upvalue() {
-        upvalues_ = upvalues_.subspan(1);
+    template <var_index_t local>
+    constexpr void assign_at(const value_t& value) {
+        if constexpr (local.captured_)
+            display_[local.env_depth_].upvalues_[local.env_index_].assign(value);
+        else if constexpr (local.borrowed_)
+            *display_[local.env_depth_].borrowed_[local.env_index_] = value;
+        else
+            display_[local.env_depth_].values_[local.env_index_] = value;
+    }
 
-        if (upvalues_.empty()) {
-            heap_ = nullptr;
-        }
+    // Releases the variables of a block which shares this environment's frame.
+    constexpr void clear_block(const frame_t& block) {
+        assert(block.merged_);
+        std::fill_n(display_[0].values_ + block.values_first_, block.values_size_, nil);
+        std::fill_n(display_[0].upvalues_ + block.upvalues_first_, block.upvalues_size_, shared_value_t());
     }
 
-    environment* enclosing_ = nullptr;
+    template <int arity>
+    constexpr void define_native(std::string_view name, auto&& fn) {
+        assert(display_.empty() && "native functions can only be defined at the global scope");
+        define(name, make_native_function<arity>(name, std::forward<decltype(fn)>(fn)));
+    }
+
+    // Like the above, but stateless natives don't allocate, see make_native_function().
+    template <int arity, string name>
+    constexpr void define_native(auto&& fn) {
+        assert(display_.empty() && "native functions can only be defined at the global scope");
+        define(name, make_native_function<arity, name>(std::forward<decltype(fn)>(fn)));
+    }
+
+private:
+    [[nodiscard]] constexpr program_allocator<std::byte> get_allocator() const noexcept {
+        return heap_ ? heap_->get_allocator() : program_allocator<std::byte>();
+    }
+
+    constexpr int find_global(const token_t& name) const {
+        assert(display_.empty() && "only globals can be looked up by name");
+        const auto it = std::ranges::find(names_, name.lexeme_);
+        if (it == names_.end()) {
+            throw runtime_error(name, "Undefined variable.");
+        }
+        return static_cast<int>(std::distance(names_.begin(), it));
+    }
 
+    // local environments
     heap_t* heap_ = nullptr;
-    std::span<const var_index_t> upvalues_;
+    std::span<frame_ref_t> display_;
+
+    // closures
+    _program_vector<shared_value_t> upvalues_;
+    _program_vector<value_t*> borrowed_;
 
-    // NOTE: vector is only necessary for globals.
-    // Other scopes could potentially use static-sized arrays, thanks to the resolver.
-    std::vector<variable_t> values_;
+    // global environment; globals which are declared but not yet defined are empty.
+    _program_vector<_program_string> names_;
+    _program_vector<std::optional<value_t>> globals_;
 };
 
 }  // namespace ctlox::v2
\ No newline at end of file
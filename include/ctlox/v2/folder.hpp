@@ -0,0 +1,284 @@
+#pragma once
+
+#include <ctlox/v2/exception.hpp>
+#include <ctlox/v2/expression.hpp>
+#include <ctlox/v2/flat_ast.hpp>
+#include <ctlox/v2/literal.hpp>
+
+#include <algorithm>
+#include <array>
+#include <cassert>
+#include <concepts>
+#include <optional>
+#include <span>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <variant>
+#include <vector>
+
+namespace ctlox::v2 {
+
+template <typename Ast>
+constexpr const literal_t* _literal_of(const Ast& ast, flat_expr_ptr ptr) {
+    const flat_literal_expr* literal = ast[ptr].template get_if<flat_literal_expr>();
+    return literal ? &literal->value_ : nullptr;
+}
+
+constexpr bool _is_truthy(const literal_t& value) {
+    if (std::holds_alternative<nil_t>(value))
+        return false;
+    if (const bool* b = std::get_if<bool>(&value))
+        return *b;
+    return true;
+}
+
+// Empties an expression which is no longer referenced, along with its operands, so that later passes
+// (such as collecting the constant pool) don't see it.
+template <typename Ast>
+constexpr void _discard_expr(Ast& ast, flat_expr_ptr ptr) {
+    ast[ptr].visit([&ast]<typename Expr>(const Expr& expr) {
+        if constexpr (std::same_as<Expr, flat_assign_expr>) {
+            _discard_expr(ast, expr.value_);
+        } else if constexpr (std::same_as<Expr, flat_binary_expr> || std::same_as<Expr, flat_logical_expr>) {
+            _discard_expr(ast, expr.left_);
+            _discard_expr(ast, expr.right_);
+        } else if constexpr (std::same_as<Expr, flat_call_expr>) {
+            _discard_expr(ast, expr.callee_);
+            for (flat_expr_ptr argument : expr.arguments_) {
+                _discard_expr(ast, argument);
+            }
+        } else if constexpr (std::same_as<Expr, flat_grouping_expr>) {
+            _discard_expr(ast, expr.expr_);
+        } else if constexpr (std::same_as<Expr, flat_unary_expr>) {
+            _discard_expr(ast, expr.right_);
+        }
+    });
+
+    ast.expressions_[ptr.i] = flat_expr_t {};
+}
+
+// Rewrites the expressions whose operands are all literals into literals, so that they're evaluated once
+// while compiling rather than every time they run. Folding an expression which would fail at runtime
+// reports its error at compile time instead.
+//
+// Concatenated strings need storage of their own, which the flat AST doesn't have: they're taken in order
+// from strings. If it's empty, they're collected instead (see concatenations()), to size it, see static_fold().
+template <typename Ast>
+class constant_folder {
+public:
+    constexpr explicit constant_folder(Ast ast, std::span<const char> strings = {})
+        : ast_(std::move(ast))
+        , strings_(strings) {
+        if (strings_.empty()) {
+            // Every expression folds at most once, so collected strings never move.
+            concatenations_.reserve(ast_.expressions_.size());
+        }
+    }
+
+    constexpr Ast fold() && {
+        // Operands are serialized after the expression they belong to, so going backwards folds them first.
+        for (std::size_t i = ast_.expressions_.size(); i-- > 0;) {
+            std::optional<flat_expr_t> folded = ast_.expressions_[i].visit(*this);
+            if (folded) {
+                ast_.expressions_[i] = std::move(*folded);
+            }
+        }
+
+        return std::move(ast_);
+    }
+
+    constexpr std::optional<flat_expr_t> operator()(const flat_binary_expr& expr) {
+        const literal_t* left = literal_of(expr.left_);
+        const literal_t* right = literal_of(expr.right_);
+        if (!left || !right)
+            return std::nullopt;
+
+        const auto* left_string = std::get_if<std::string_view>(left);
+        const auto* right_string = std::get_if<std::string_view>(right);
+        std::optional<literal_t> value = expr.operator_.type_ == token_type::plus && left_string && right_string
+            ? literal_t(concatenate(*left_string, *right_string))
+            : fold_binary(expr.operator_, *left, *right);
+        if (!value)
+            return std::nullopt;
+
+        discard(expr.left_);
+        discard(expr.right_);
+        return flat_literal_expr { *value };
+    }
+
+    constexpr std::optional<flat_expr_t> operator()(const flat_grouping_expr& expr) {
+        const literal_t* value = literal_of(expr.expr_);
+        if (!value)
+            return std::nullopt;
+
+        const literal_t folded = *value;
+        discard(expr.expr_);
+        return flat_literal_expr { folded };
+    }
+
+    constexpr std::optional<flat_expr_t> operator()(const flat_logical_expr& expr) {
+        const literal_t* left = literal_of(expr.left_);
+        if (!left)
+            return std::nullopt;
+
+        // The right operand is only evaluated if the left one doesn't decide the result.
+        const bool short_circuits = expr.operator_.type_ == token_type::_or ? _is_truthy(*left) : !_is_truthy(*left);
+        if (short_circuits) {
+            const literal_t folded = *left;
+            discard(expr.left_);
+            discard(expr.right_);
+            return flat_literal_expr { folded };
+        }
+
+        discard(expr.left_);
+        if (const literal_t* right = literal_of(expr.right_)) {
+            const literal_t folded = *right;
+            discard(expr.right_);
+            return flat_literal_expr { folded };
+        }
+        return flat_grouping_expr { .expr_ = expr.right_ };
+    }
+
+    constexpr std::optional<flat_expr_t> operator()(const flat_unary_expr& expr) {
+        const literal_t* right = literal_of(expr.right_);
+        if (!right)
+            return std::nullopt;
+
+        literal_t value;
+        if (expr.operator_.type_ == token_type::bang) {
+            value = !_is_truthy(*right);
+        } else if (const double* number = std::get_if<double>(right)) {
+            value = -*number;
+        } else {
+            throw runtime_error(expr.operator_, "Operand must be a number.");
+        }
+
+        discard(expr.right_);
+        return flat_literal_expr { value };
+    }
+
+    constexpr std::optional<flat_expr_t> operator()(const auto&) { return std::nullopt; }
+
+    // The strings which concatenations were folded into, one after the other, if they were collected.
+    [[nodiscard]] constexpr std::string concatenations() const {
+        std::string strings;
+        for (const std::string& string : concatenations_) {
+            strings += string;
+        }
+        return strings;
+    }
+
+private:
+    constexpr const literal_t* literal_of(flat_expr_ptr ptr) const { return _literal_of(ast_, ptr); }
+    constexpr void discard(flat_expr_ptr ptr) { _discard_expr(ast_, ptr); }
+
+    constexpr std::string_view concatenate(std::string_view left, std::string_view right) {
+        std::string string = std::string(left) + std::string(right);
+        if (string.empty())
+            return {};
+
+        if (strings_.empty())
+            return concatenations_.emplace_back(std::move(string));
+
+        const std::span<const char> chars = strings_.first(string.size());
+        strings_ = strings_.subspan(string.size());
+        assert(std::ranges::equal(chars, string));
+        return std::string_view(chars.data(), chars.size());
+    }
+
+    // Infinities and NaNs aren't constant expressions, so only arithmetic which is sure to stay finite is folded.
+    static constexpr bool in_range(double number) { return -1e150 <= number && number <= 1e150; }
+
+    static constexpr std::optional<literal_t> fold_binary(
+        const token_t& oper, const literal_t& left, const literal_t& right) {
+        switch (oper.type_) {
+        case token_type::equal_equal:
+            return literal_t(left == right);
+        case token_type::bang_equal:
+            return literal_t(left != right);
+        default:
+            break;
+        }
+
+        const double* lhs = std::get_if<double>(&left);
+        const double* rhs = std::get_if<double>(&right);
+
+        // Concatenations have been folded already.
+        if (oper.type_ == token_type::plus && !(lhs && rhs)) {
+            throw runtime_error(oper, "Operands must be two numbers or two strings.");
+        }
+
+        if (!lhs || !rhs) {
+            throw runtime_error(oper, "Operands must be numbers.");
+        }
+
+        switch (oper.type_) {
+        case token_type::less:
+            return literal_t(*lhs < *rhs);
+        case token_type::less_equal:
+            return literal_t(*lhs <= *rhs);
+        case token_type::greater:
+            return literal_t(*lhs > *rhs);
+        case token_type::greater_equal:
+            return literal_t(*lhs >= *rhs);
+        default:
+            break;
+        }
+
+        if (!in_range(*lhs) || !in_range(*rhs))
+            return std::nullopt;
+
+        switch (oper.type_) {
+        case token_type::plus:
+            return literal_t(*lhs + *rhs);
+        case token_type::minus:
+            return literal_t(*lhs - *rhs);
+        case token_type::star:
+            return literal_t(*lhs * *rhs);
+        case token_type::slash:
+            if (-1e-150 < *rhs && *rhs < 1e-150)
+                return std::nullopt;
+            return literal_t(*lhs / *rhs);
+        default:
+            return std::nullopt;
+        }
+    }
+
+    Ast ast_;
+    std::span<const char> strings_;
+    std::vector<std::string> concatenations_;
+};
+
+// Folds the constants of ast. strings holds the strings which its concatenations fold into, see
+// _fold_concatenations().
+template <_flat_ast Ast>
+constexpr Ast fold_constants(Ast ast, std::span<const char> strings) {
+    return constant_folder<Ast>(std::move(ast), strings).fold();
+}
+
+// The strings which the concatenations of ast fold into, one after the other.
+template <_flat_ast Ast>
+constexpr std::string _fold_concatenations(Ast ast) {
+    constant_folder<Ast> folder(std::move(ast));
+    // The folded AST refers to the folder's strings, so it's only folded for them.
+    (void)std::move(folder).fold();
+    return folder.concatenations();
+}
+
+template <const auto& ast>
+    requires _flat_ast<decltype(ast)>
+constexpr auto static_fold() {
+    constexpr std::size_t K = _fold_concatenations(ast).size();
+
+    // Concatenated strings are kept here, for literals to refer to, like string literals refer to the source.
+    static constexpr std::array<char, K> strings = [] {
+        std::array<char, K> strings {};
+        std::ranges::copy(_fold_concatenations(ast), strings.begin());
+        return strings;
+    }();
+
+    return fold_constants(ast, strings);
+}
+
+}  // namespace ctlox::v2
\ No newline at end of file
@@ -1,42 +1,64 @@
 #pragma once
 
+#include <concepts>
 #include <format>
-#include <memory>
 #include <span>
+#include <string>
+#include <type_traits>
+#include <utility>
 
 namespace ctlox::v2 {
 
 class value_t;
 struct program_state_t;
 
+class _object_base;
 class _function_impl_base;
+class function;
 
+// Ref-counted handle onto a function implementation (and, for Lox functions, its closure).
+// Copying a function shares the same implementation.
+//
+// At runtime, stateless native functions whose name is known at compile time are implemented by
+// static objects instead (see make_native_function()), so defining and copying them never allocates.
 class function final {
 public:
     constexpr function() = default;
     constexpr ~function() noexcept;
 
     template <typename Callable>
+        requires(!std::same_as<std::remove_cvref_t<Callable>, function>)
     constexpr explicit function(Callable&& callable);
 
-    constexpr function(const function& other);
-    constexpr function& operator=(const function& other);
-    constexpr function(function&& other) = default;
-    constexpr function& operator=(function&& other) = default;
+    constexpr function(const function& other) noexcept;
+    constexpr function& operator=(const function& other) noexcept;
+    constexpr function(function&& other) noexcept;
+    constexpr function& operator=(function&& other) noexcept;
 
-    friend constexpr void swap(function& lhs, function& rhs) noexcept { std::ranges::swap(lhs.impl_, rhs.impl_); }
+    friend constexpr void swap(function& lhs, function& rhs) noexcept { std::swap(lhs.impl_, rhs.impl_); }
 
-    [[nodiscard]] constexpr bool operator==(const function& other) const noexcept = default;
+    // Adopts a reference to an object holding a function implementation, without acquiring it.
+    static constexpr function adopt(_object_base* object) noexcept;
+
+    // Gives up ownership of the implementation, leaving this empty.
+    [[nodiscard]] constexpr _object_base* release() && noexcept;
+
+    [[nodiscard]] constexpr bool operator==(const function& other) const noexcept { return impl_ == other.impl_; }
+
+    // The object holding the implementation, or nullptr for static ones, which refer to no heap entries.
+    [[nodiscard]] constexpr _object_base* object() const noexcept;
 
     [[nodiscard]] constexpr std::string name() const;
     [[nodiscard]] constexpr int arity() const;
     constexpr value_t operator()(const program_state_t& state, std::span<const value_t> arguments) const;
 
-
 private:
-    std::unique_ptr<_function_impl_base> impl_;
+    _function_impl_base* impl_ = nullptr;
 };
 
+// A function is as small as a value_t's other heap alternatives, so it doesn't grow the variant representation.
+static_assert(sizeof(function) == sizeof(void*));
+
 }  // namespace ctlox::v2
 
 template <>
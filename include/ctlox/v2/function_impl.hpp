@@ -1,8 +1,13 @@
 #pragma once
 
 #include <ctlox/v2/function.hpp>
+#include <ctlox/v2/object.hpp>
 #include <ctlox/v2/value.hpp>
 
+#include <algorithm>
+#include <cassert>
+#include <utility>
+
 namespace ctlox::v2 {
 
 template <typename Function>
@@ -12,57 +17,99 @@ concept callable = requires(const Function& function, const program_state_t& sta
     { function(state, args) } -> std::convertible_to<value_t>;
 };
 
-class _function_impl_base {
+class _function_impl_base : public _object_base {
 public:
-    virtual ~_function_impl_base() = default;
+    constexpr _function_impl_base() noexcept
+        : _object_base(_value_index_v<function>) { }
+
+    constexpr explicit _function_impl_base(_static_object_t tag) noexcept
+        : _object_base(_value_index_v<function>, tag) { }
 
     [[nodiscard]] constexpr virtual std::string name() const = 0;
     [[nodiscard]] constexpr virtual int arity() const = 0;
     constexpr virtual value_t operator()(const program_state_t& state, std::span<const value_t> arguments) const = 0;
-    [[nodiscard]] virtual std::unique_ptr<_function_impl_base> clone() const = 0;
 };
 
 template <callable Callable>
-class _function_impl : public _function_impl_base {
+class _function_impl final : public _function_impl_base {
 public:
     constexpr _function_impl(const Callable& callable)  // NOLINT(*-explicit-constructor)
         : callable_(callable) { }
     constexpr _function_impl(Callable&& callable)       // NOLINT(*-explicit-constructor)
         : callable_(std::move(callable)) { }
 
-    constexpr _function_impl(const _function_impl& other) = default;
-    constexpr _function_impl& operator=(const _function_impl& other) = default;
-
     [[nodiscard]] constexpr std::string name() const override { return callable_.name(); }
     [[nodiscard]] constexpr int arity() const override { return callable_.arity(); }
     constexpr value_t operator()(const program_state_t& state, std::span<const value_t> arguments) const override {
         return callable_(state, arguments);
     }
 
-    [[nodiscard]] constexpr std::unique_ptr<_function_impl_base> clone() const override {
-        return std::make_unique<_function_impl>(*this);
+    constexpr void trace(_heap_tracer& tracer) const override {
+        if constexpr (requires { callable_.trace(tracer); })
+            callable_.trace(tracer);
     }
 
     Callable callable_;
+
+private:
+    constexpr void destroy() noexcept override { _delete_object(this); }
 };
 
-constexpr function::~function() noexcept = default;
+// The callable of a function object which is known to have been created from a Callable,
+// without going through its implementation's virtual functions.
+template <callable Callable>
+constexpr const Callable& _callable_of(const _object_base* object) noexcept {
+    assert(object && object->type_index() == _value_index_v<function>);
+    return static_cast<const _function_impl<Callable>*>(object)->callable_;
+}
+
+constexpr function::~function() noexcept {
+    if (impl_)
+        impl_->release();
+}
 
 template <typename Callable>
+    requires(!std::same_as<std::remove_cvref_t<Callable>, function>)
 constexpr function::function(Callable&& callable)
-    : impl_(std::make_unique<_function_impl<std::decay_t<Callable>>>(std::forward<Callable>(callable))) { }
+    : impl_(_new_object<_function_impl<std::decay_t<Callable>>>(std::forward<Callable>(callable))) { }
 
-constexpr function::function(const function& other)
-    : impl_(other.impl_->clone()) { }
+constexpr function::function(const function& other) noexcept
+    : impl_(other.impl_) {
+    if (impl_)
+        impl_->acquire();
+}
 
-constexpr function& function::operator=(const function& other) {
+constexpr function& function::operator=(const function& other) noexcept {
     function tmp(other);
     swap(*this, tmp);
     return *this;
 }
 
+constexpr function::function(function&& other) noexcept
+    : impl_(std::exchange(other.impl_, nullptr)) { }
+
+constexpr function& function::operator=(function&& other) noexcept {
+    function tmp(std::move(other));
+    swap(*this, tmp);
+    return *this;
+}
+
+constexpr function function::adopt(_object_base* object) noexcept {
+    function fn;
+    fn.impl_ = static_cast<_function_impl_base*>(object);
+    return fn;
+}
+
+[[nodiscard]] constexpr _object_base* function::release() && noexcept { return std::exchange(impl_, nullptr); }
+
+[[nodiscard]] constexpr _object_base* function::object() const noexcept {
+    return impl_ && !impl_->is_static() ? impl_ : nullptr;
+}
+
 [[nodiscard]] constexpr std::string function::name() const { return impl_->name(); }
+
 [[nodiscard]] constexpr int function::arity() const { return impl_->arity(); }
+
 constexpr value_t function::operator()(const program_state_t& state, std::span<const value_t> arguments) const {
     return (*impl_)(state, arguments);
 }
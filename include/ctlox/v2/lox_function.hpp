@@ -7,22 +7,22 @@
 #include <ctlox/v2/value.hpp>
 
 #include <cassert>
-#include <ranges>
 #include <span>
 #include <string_view>
+#include <utility>
 
 namespace ctlox::v2 {
 
 template <
     const std::string_view& name_,
-    span_t<token_t> s_params_,
+    span_t<declaration_t> s_params_,
     span_t<var_index_t> s_closure_upvalues_,
-    span_t<var_index_t> s_scope_upvalues_,
+    std::size_t values_size_,
+    std::size_t upvalues_size_,
     typename Body>
 class lox_function {
-    static constexpr std::span<const token_t> params_ = s_params_;
+    static constexpr std::span<const declaration_t> params_ = s_params_;
     static constexpr std::span<const var_index_t> closure_upvalues_ = s_closure_upvalues_;
-    static constexpr std::span<const var_index_t> scope_upvalues_ = s_scope_upvalues_;
 
 public:
     constexpr lox_function(environment* env)
@@ -34,10 +34,14 @@ public:
     constexpr value_t operator()(const program_state_t& state, std::span<const value_t> arguments) const {
         assert(arguments.size() == arity());
 
-        environment env(&closure_, state.heap_, scope_upvalues_);
-        for (const auto& [param, argument] : std::views::zip(params_, arguments)) {
-            env.define(param.lexeme_, argument);
-        }
+        // A function's environment can refer to its own variables and to its closure.
+        environment::frame_storage<values_size_, upvalues_size_> frame;
+        environment::display_storage<2> display;
+        environment env(&closure_, state.heap_, frame, display);
+
+        [&]<std::size_t... I>(std::index_sequence<I...>) {
+            (env.define_at<params_[I].slot_>(arguments[I]), ...);
+        }(std::make_index_sequence<params_.size()>());
 
         return_slot return_slot;
         const program_state_t function_state = state.with(&env).with(&return_slot);
@@ -46,9 +50,11 @@ public:
         return std::move(return_slot)();
     }
 
+    constexpr void trace(_heap_tracer& tracer) const { closure_.trace(tracer); }
+
 private:
-    // Closure only holds shared_values and so all accesses will actually
-    // go through to the heap.
+    // Closure only holds shared_values, whose accesses go through to the heap,
+    // and, if the function doesn't escape, pointers into the frames it captures from.
     mutable environment closure_;
 };
 
@@ -0,0 +1,78 @@
+#pragma once
+
+#include <ctlox/v2/object.hpp>
+
+#include <concepts>
+#include <string>
+#include <string_view>
+#include <utility>
+
+namespace ctlox::v2 {
+
+// Shared, immutable Lox string.
+// Copying a lox_string only bumps the ref-count of the underlying object.
+class lox_string final {
+    using object_t = _boxed_object<std::string>;
+
+public:
+    template <typename T>
+        requires std::constructible_from<std::string, T&&>
+    constexpr explicit(!std::convertible_to<T&&, std::string>) lox_string(T&& value)  // NOLINT(*-explicit-constructor)
+        : object_(_new_object<object_t>(_value_index_v<std::string>, std::forward<T>(value))) { }
+
+    // Adopts an object reference, without acquiring it.
+    constexpr explicit lox_string(object_t* object) noexcept
+        : object_(object) { }
+
+    constexpr lox_string(const lox_string& other) noexcept
+        : object_(other.object_) {
+        if (object_)
+            object_->acquire();
+    }
+
+    constexpr lox_string& operator=(const lox_string& other) noexcept {
+        lox_string tmp(other);
+        swap(*this, tmp);
+        return *this;
+    }
+
+    constexpr lox_string(lox_string&& other) noexcept
+        : object_(std::exchange(other.object_, nullptr)) { }
+
+    constexpr lox_string& operator=(lox_string&& other) noexcept {
+        lox_string tmp(std::move(other));
+        swap(*this, tmp);
+        return *this;
+    }
+
+    constexpr ~lox_string() noexcept {
+        if (object_)
+            object_->release();
+    }
+
+    friend constexpr void swap(lox_string& lhs, lox_string& rhs) noexcept { std::swap(lhs.object_, rhs.object_); }
+
+    [[nodiscard]] constexpr const std::string& get() const noexcept { return object_->value_; }
+
+    // Strings are immutable as far as Lox is concerned, but when this is the only reference
+    // to the string, nobody can observe it being appended to in place.
+    constexpr bool append_if_unique(std::string_view suffix) {
+        if (!object_->unique())
+            return false;
+
+        object_->value_.append(suffix);
+        return true;
+    }
+
+    // Gives up ownership of the object reference, leaving this empty.
+    [[nodiscard]] constexpr object_t* release() && noexcept { return std::exchange(object_, nullptr); }
+
+    [[nodiscard]] constexpr bool operator==(const lox_string& other) const noexcept {
+        return object_ == other.object_ || get() == other.get();
+    }
+
+private:
+    object_t* object_ = nullptr;
+};
+
+}  // namespace ctlox::v2
\ No newline at end of file
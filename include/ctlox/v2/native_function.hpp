@@ -1,11 +1,14 @@
 #pragma once
 
+#include <ctlox/common/string.hpp>
 #include <ctlox/v2/value.hpp>
 
+#include <cassert>
 #include <concepts>
 #include <span>
 #include <string>
 #include <string_view>
+#include <type_traits>
 #include <utility>
 
 namespace ctlox::v2 {
@@ -21,16 +24,20 @@ public:
     [[nodiscard]] constexpr int arity() const noexcept { return arity_; }
 
     constexpr value_t operator()(const program_state_t& state, std::span<const value_t> arguments) const {
+        return invoke(fn_, state, arguments);
+    }
+
+    static constexpr value_t invoke(const Fn& fn, const program_state_t& state, std::span<const value_t> arguments) {
         using index_sequence = std::make_index_sequence<arity_>;
         return [&]<std::size_t... I>(std::index_sequence<I...>) -> value_t {
-            if constexpr (requires { fn_(state, arguments[I]...); }) {
-                using result_type = decltype(fn_(state, arguments[I]...));
+            if constexpr (requires { fn(state, arguments[I]...); }) {
+                using result_type = decltype(fn(state, arguments[I]...));
                 if constexpr (std::convertible_to<value_t, result_type>) {
-                    return fn_(state, arguments[I]...);
+                    return fn(state, arguments[I]...);
                 }
 
                 else if constexpr (std::same_as<void, result_type>) {
-                    fn_(state, arguments[I]...);
+                    fn(state, arguments[I]...);
                     return nil;
                 }
 
@@ -39,14 +46,14 @@ public:
                 }
             }
 
-            else if constexpr (requires { fn_(arguments[I]...); }) {
-                using result_type = decltype(fn_(arguments[I]...));
+            else if constexpr (requires { fn(arguments[I]...); }) {
+                using result_type = decltype(fn(arguments[I]...));
                 if constexpr (std::convertible_to<value_t, result_type>) {
-                    return fn_(arguments[I]...);
+                    return fn(arguments[I]...);
                 }
 
                 else if constexpr (std::same_as<void, result_type>) {
-                    fn_(arguments[I]...);
+                    fn(arguments[I]...);
                     return nil;
                 }
 
@@ -69,4 +76,48 @@ private:
     Fn fn_;
 };
 
+template <typename Fn>
+concept _stateless_native = std::is_empty_v<Fn> && std::default_initializable<Fn>;
+
+// Stateless native function whose name is known at compile time, which lives in static storage rather
+// than being allocated, see make_native_function().
+template <int arity_, _stateless_native Fn, string name_>
+class _static_native_function final : public _function_impl_base {
+public:
+    constexpr _static_native_function() noexcept
+        : _function_impl_base(_static_object) { }
+
+    [[nodiscard]] constexpr std::string name() const override { return std::string(std::string_view(name_)); }
+    [[nodiscard]] constexpr int arity() const override { return arity_; }
+    constexpr value_t operator()(const program_state_t& state, std::span<const value_t> arguments) const override {
+        return native_function<arity_, Fn>::invoke(Fn {}, state, arguments);
+    }
+
+private:
+    constexpr void destroy() noexcept override { assert(false && "static objects are never released"); }
+};
+
+template <int arity, _stateless_native Fn, string name>
+inline constinit _static_native_function<arity, Fn, name> _static_native_function_v;
+
+// Wraps fn into a function.
+template <int arity, typename Fn>
+constexpr function make_native_function(std::string_view name, Fn&& fn) {
+    return function(native_function<arity, std::decay_t<Fn>>(name, std::forward<Fn>(fn)));
+}
+
+// Wraps fn into a function named name. At runtime, stateless callables are implemented by a static
+// object rather than an allocated one, which spares their allocation, and keeps values holding them
+// from allocating too.
+template <int arity, string name, typename Fn>
+constexpr function make_native_function(Fn&& fn) {
+    if !consteval {
+        if constexpr (_stateless_native<std::decay_t<Fn>>) {
+            return function::adopt(&_static_native_function_v<arity, std::decay_t<Fn>, name>);
+        }
+    }
+
+    return make_native_function<arity>(name, std::forward<Fn>(fn));
+}
+
 }  // namespace ctlox::v2
\ No newline at end of file
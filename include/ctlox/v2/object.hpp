@@ -0,0 +1,160 @@
+#pragma once
+
+#include <ctlox/v2/allocator.hpp>
+#include <ctlox/v2/literal.hpp>
+#include <ctlox/v2/stats.hpp>
+
+#include <cassert>
+#include <concepts>
+#include <memory>
+#include <memory_resource>
+#include <string>
+#include <utility>
+
+namespace ctlox::v2 {
+
+class function;
+class heap_t;
+struct shared_value_t;
+
+// Index of each value_t alternative, also used as the type index of the objects holding them.
+template <typename Value>
+constexpr int _value_index_v = [] {
+    if constexpr (std::same_as<Value, nil_t>)
+        return 0;
+    else if constexpr (std::same_as<Value, bool>)
+        return 1;
+    else if constexpr (std::same_as<Value, double>)
+        return 2;
+    else if constexpr (std::same_as<Value, std::string>)
+        return 3;
+    else if constexpr (std::same_as<Value, function>)
+        return 4;
+    else
+        static_assert(false, "Not a value_t alternative.");
+}();
+
+// Visits the heap_t entries an object refers to, see heap_t::collect().
+class _heap_tracer {
+public:
+    constexpr virtual void operator()(const shared_value_t& upvalue) = 0;
+
+protected:
+    constexpr ~_heap_tracer() = default;
+};
+
+// Tag of the constructor of objects in static storage.
+struct _static_object_t {
+    explicit _static_object_t() = default;
+};
+
+inline constexpr _static_object_t _static_object {};
+
+// Intrusively ref-counted heap object, used for values which don't fit inline in a value_t.
+// Objects are allocated by _new_object(), with a count of 1 which is owned by whoever created them.
+class _object_base {
+public:
+    constexpr explicit _object_base(int type_index) noexcept
+        : type_index_(type_index)
+        , resource_(_thread_allocator<std::byte>().resource()) { }
+
+    // Objects in static storage aren't ref-counted, so they are never destroyed, and they can be shared
+    // between threads. Only functions which refer to no heap entries live there, see function::object().
+    constexpr _object_base(int type_index, _static_object_t) noexcept
+        : type_index_(type_index)
+        , static_(true) { }
+
+    constexpr virtual ~_object_base() = default;
+
+    _object_base(const _object_base&) = delete;
+    _object_base& operator=(const _object_base&) = delete;
+
+    [[nodiscard]] constexpr int type_index() const noexcept { return type_index_; }
+
+    [[nodiscard]] constexpr bool unique() const noexcept { return count_ == 1; }
+
+    [[nodiscard]] constexpr bool is_static() const noexcept { return static_; }
+
+    constexpr void acquire() noexcept {
+        if (static_)
+            return;
+
+        ++count_;
+        _record_stats([this](memory_stats_t& stats) {
+            if (type_index_ == _value_index_v<std::string>)
+                ++stats.string_copies_;
+            else if (type_index_ == _value_index_v<function>)
+                ++stats.function_copies_;
+        });
+    }
+
+    constexpr void release() noexcept {
+        if (static_)
+            return;
+
+        assert(count_ > 0);
+        if (--count_ == 0) {
+            destroy();
+        }
+    }
+
+    // Visits the heap_t entries this object refers to. Only closures refer to any.
+    constexpr virtual void trace(_heap_tracer&) const { }
+
+    // The resource this object was allocated from, which outlives it.
+    [[nodiscard]] constexpr std::pmr::memory_resource* resource() const noexcept { return resource_; }
+
+protected:
+    // Destroys and deallocates this object, see _delete_object().
+    constexpr virtual void destroy() noexcept = 0;
+
+private:
+    friend heap_t;
+
+    int type_index_ = -1;
+    int count_ = 1;
+    std::pmr::memory_resource* resource_ = nullptr;
+
+    // Bookkeeping of heap_t::collect(): the references left once those from the heap are
+    // taken away (-1 until visited), and whether the object is reachable from outside the heap.
+    int gc_refs_ = -1;
+    bool gc_marked_ = false;
+
+    bool static_ = false;
+};
+
+// Allocates an object from the running program's memory resource, which it keeps for its deallocation.
+template <std::derived_from<_object_base> T, typename... Args>
+[[nodiscard]] constexpr T* _new_object(Args&&... args) {
+    program_allocator<T> allocator = _thread_allocator<T>();
+    T* object = allocator.allocate(1);
+    try {
+        return std::construct_at(object, std::forward<Args>(args)...);
+    } catch (...) {
+        allocator.deallocate(object, 1);
+        throw;
+    }
+}
+
+template <std::derived_from<_object_base> T>
+constexpr void _delete_object(T* object) noexcept {
+    program_allocator<T> allocator(object->resource());
+    std::destroy_at(object);
+    allocator.deallocate(object, 1);
+}
+
+template <typename T>
+class _boxed_object final : public _object_base {
+public:
+    template <typename... Args>
+    constexpr explicit _boxed_object(int type_index, Args&&... args)
+        : _object_base(type_index)
+        , value_(std::forward<Args>(args)...) { }
+
+    T value_;
+
+private:
+    constexpr void destroy() noexcept override { _delete_object(this); }
+};
+
+}  // namespace ctlox::v2
\ No newline at end of file
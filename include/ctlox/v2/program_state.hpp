@@ -22,14 +22,16 @@ struct return_slot {
 struct program_state_t {
     heap_t* heap_ = nullptr;
     environment* globals_ = nullptr;
+    const value_t* constants_ = nullptr;  // interned string literals, see basic_constant_pool
 
     environment* env_ = nullptr;
     break_slot* break_slot_ = nullptr;
     return_slot* return_slot_ = nullptr;
 
-    constexpr program_state_t(heap_t* heap, environment* globals)
-        : globals_(globals)
-        , heap_(heap)
+    constexpr program_state_t(heap_t* heap, environment* globals, const value_t* constants)
+        : heap_(heap)
+        , globals_(globals)
+        , constants_(constants)
         , env_(globals_) { }
 
     constexpr program_state_t with(environment* env) const {
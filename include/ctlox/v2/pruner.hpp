@@ -0,0 +1,151 @@
+#pragma once
+
+#include <ctlox/v2/flat_ast.hpp>
+#include <ctlox/v2/folder.hpp>
+#include <ctlox/v2/statement.hpp>
+
+#include <optional>
+#include <utility>
+
+namespace ctlox::v2 {
+
+// Removes the statements which can never run, so that no code is generated for them: the branch not taken
+// by an if whose condition is a literal (see constant_folder), loops whose condition is a falsy literal,
+// and statements which follow a return or a break in the same block.
+template <typename Ast>
+class dead_code_pruner {
+public:
+    constexpr explicit dead_code_pruner(Ast ast)
+        : ast_(std::move(ast)) { }
+
+    constexpr Ast prune() && {
+        // Nested statements are serialized after the statement they belong to, so going backwards prunes them first.
+        for (std::size_t i = ast_.statements_.size(); i-- > 0;) {
+            std::optional<flat_stmt_t> pruned = ast_.statements_[i].visit(*this);
+            if (pruned) {
+                ast_.statements_[i] = std::move(*pruned);
+            }
+        }
+        ast_.root_block_ = prune_list(ast_.root_block_);
+
+        return std::move(ast_);
+    }
+
+    constexpr std::optional<flat_stmt_t> operator()(const flat_block_stmt& stmt) {
+        const flat_stmt_list statements = prune_list(stmt.statements_);
+        if (statements.last_ == stmt.statements_.last_)
+            return std::nullopt;
+
+        return flat_block_stmt { .statements_ = statements };
+    }
+
+    constexpr std::optional<flat_stmt_t> operator()(const flat_function_stmt& stmt) {
+        const flat_stmt_list body = prune_list(stmt.body_);
+        if (body.last_ == stmt.body_.last_)
+            return std::nullopt;
+
+        return flat_function_stmt { .name_ = stmt.name_, .params_ = stmt.params_, .body_ = body };
+    }
+
+    constexpr std::optional<flat_stmt_t> operator()(const flat_if_stmt& stmt) {
+        const literal_t* condition = _literal_of(ast_, stmt.condition_);
+        if (!condition)
+            return std::nullopt;
+
+        const bool truthy = _is_truthy(*condition);
+        const flat_stmt_ptr taken = truthy ? stmt.then_branch_ : stmt.else_branch_;
+        const flat_stmt_ptr skipped = truthy ? stmt.else_branch_ : stmt.then_branch_;
+
+        _discard_expr(ast_, stmt.condition_);
+        if (skipped != flat_nullptr)
+            discard(skipped);
+
+        if (taken == flat_nullptr)
+            return flat_block_stmt {};
+
+        // The branch taken replaces the if statement, and its own slot is left unreferenced.
+        return std::exchange(ast_.statements_[taken.i], flat_stmt_t {});
+    }
+
+    constexpr std::optional<flat_stmt_t> operator()(const flat_while_stmt& stmt) {
+        const literal_t* condition = _literal_of(ast_, stmt.condition_);
+        if (!condition || _is_truthy(*condition))
+            return std::nullopt;
+
+        _discard_expr(ast_, stmt.condition_);
+        discard(stmt.body_);
+        return flat_block_stmt {};
+    }
+
+    constexpr std::optional<flat_stmt_t> operator()(const auto&) { return std::nullopt; }
+
+private:
+    // Drops the statements following the first return or break of a list.
+    constexpr flat_stmt_list prune_list(flat_stmt_list list) {
+        for (std::size_t i = 0; i < list.size(); ++i) {
+            const flat_stmt_t& stmt = ast_[list[i]];
+            if (!stmt.holds<flat_return_stmt>() && !stmt.holds<flat_break_stmt>())
+                continue;
+
+            const flat_stmt_list reachable { .first_ = list.first_, .last_ = { list.first_.i + i + 1 } };
+            for (std::size_t j = i + 1; j < list.size(); ++j) {
+                discard(list[j]);
+            }
+            return reachable;
+        }
+
+        return list;
+    }
+
+    // Empties a statement which is no longer referenced, along with the statements and expressions it holds.
+    constexpr void discard(flat_stmt_ptr ptr) {
+        const auto discard_expr = [this](flat_expr_ptr expr) {
+            if (expr != flat_nullptr)
+                _discard_expr(ast_, expr);
+        };
+        const auto discard_list = [this](flat_stmt_list list) {
+            for (flat_stmt_ptr stmt : list) {
+                discard(stmt);
+            }
+        };
+
+        ast_[ptr].visit([&, this]<typename Stmt>(const Stmt& stmt) {
+            if constexpr (std::same_as<Stmt, flat_block_stmt>) {
+                discard_list(stmt.statements_);
+            } else if constexpr (std::same_as<Stmt, flat_expression_stmt>) {
+                discard_expr(stmt.expression_);
+            } else if constexpr (std::same_as<Stmt, flat_function_stmt>) {
+                discard_list(stmt.body_);
+            } else if constexpr (std::same_as<Stmt, flat_if_stmt>) {
+                discard_expr(stmt.condition_);
+                discard(stmt.then_branch_);
+                if (stmt.else_branch_ != flat_nullptr)
+                    discard(stmt.else_branch_);
+            } else if constexpr (std::same_as<Stmt, flat_return_stmt>) {
+                discard_expr(stmt.value_);
+            } else if constexpr (std::same_as<Stmt, flat_var_stmt>) {
+                discard_expr(stmt.initializer_);
+            } else if constexpr (std::same_as<Stmt, flat_while_stmt>) {
+                discard_expr(stmt.condition_);
+                discard(stmt.body_);
+            }
+        });
+
+        ast_.statements_[ptr.i] = flat_stmt_t {};
+    }
+
+    Ast ast_;
+};
+
+template <_flat_ast Ast>
+constexpr Ast prune_dead_code(Ast ast) {
+    return dead_code_pruner<Ast>(std::move(ast)).prune();
+}
+
+template <const auto& ast>
+    requires _flat_ast<decltype(ast)>
+constexpr auto static_prune() {
+    return prune_dead_code(ast);
+}
+
+}  // namespace ctlox::v2
\ No newline at end of file
@@ -5,9 +5,14 @@
 #include <ctlox/v2/flat_ast.hpp>
 
 #include <algorithm>
+#include <array>
 #include <cassert>
 #include <functional>
+#include <iterator>
 #include <ranges>
+#include <span>
+#include <string_view>
+#include <utility>
 #include <vector>
 
 namespace ctlox::v2 {
@@ -25,9 +30,15 @@ struct span_t {
     constexpr operator std::span<const T>() const noexcept { return std::span(data_, size_); }
 };
 
+// Slot of a local variable: captured variables are upvalues, shared through the heap,
+// and env_index_ indexes either an environment's upvalues or its plain values.
+// Closures of functions which don't escape instead borrow plain values from the frames they capture
+// them from, and env_index_ then indexes the closure's borrowed values.
 struct var_index_t {
     int env_depth_ = -1;
     int env_index_ = -1;
+    bool captured_ = false;
+    bool borrowed_ = false;
 
     constexpr auto operator<=>(const var_index_t&) const noexcept = default;
 
@@ -39,24 +50,71 @@ struct local_t {
     var_index_t index_;
 };
 
-struct scope_t {
+struct closure_t {
     flat_stmt_ptr ptr_ = flat_nullptr;
     flat_list<var_index_t> upvalues_;
 };
 
-struct closure_t {
+// A call whose callee is a local function which is never reassigned, so that the function it calls is known.
+// A recursive call is made from within the function's own body (or a function nested in it).
+struct direct_call_t {
+    flat_expr_ptr ptr_ = flat_nullptr;  // the callee
+    flat_stmt_ptr function_ = flat_nullptr;
+    bool recursive_ = false;
+};
+
+// Layout of a block or function scope's environment: the number of plain and captured variables
+// declared in it, and the number of environments a local can be resolved to from within it
+// (including itself).
+// A block nested in another scope has no environment of its own (merged_): its variables take up
+// the slots from values_first_ and upvalues_first_ in the enclosing frame, and are cleared when it ends.
+struct frame_t {
     flat_stmt_ptr ptr_ = flat_nullptr;
-    flat_list<var_index_t> upvalues_;
+    std::size_t values_size_ = 0;
+    std::size_t upvalues_size_ = 0;
+    std::size_t display_size_ = 1;
+
+    bool merged_ = false;
+    std::size_t values_first_ = 0;
+    std::size_t upvalues_first_ = 0;
+
+    // Blocks which declare no variables have no frame.
+    constexpr explicit operator bool() const noexcept { return ptr_ != flat_nullptr; }
+};
+
+// Slot of a local variable declared by a statement, or of a function's parameter (param_ >= 0).
+struct declaration_t {
+    flat_stmt_ptr ptr_ = flat_nullptr;
+    int param_ = -1;
+    var_index_t slot_;
+
+    constexpr std::pair<flat_stmt_ptr, int> key() const noexcept { return { ptr_, param_ }; }
 };
 
-template <typename Locals, typename Scopes, typename Closures, typename Upvalues>
+template <
+    typename Locals,
+    typename Closures,
+    typename Upvalues,
+    typename Frames,
+    typename Declarations,
+    typename Globals,
+    typename GlobalDecls,
+    typename DirectCalls>
 struct basic_bindings_t {
     using bindings_tag = void;
 
     Locals locals_;
-    Scopes scopes_;
     Closures closures_;
     Upvalues upvalues_;
+    Frames frames_;
+    Declarations declarations_;
+
+    // Names of all globals the program declares or refers to, whose positions are their slot indices
+    // in the global environment; and the statements which declare globals.
+    Globals globals_;
+    GlobalDecls global_decls_;
+
+    DirectCalls direct_calls_;
 
     constexpr var_index_t find_local(flat_expr_ptr ptr) const noexcept {
         if (auto [it1, it2] = std::ranges::equal_range(locals_, ptr, {}, &local_t::ptr_); it1 != it2) {
@@ -65,18 +123,51 @@ struct basic_bindings_t {
         return {};
     }
 
-    constexpr std::span<const var_index_t> find_scope_upvalues(flat_stmt_ptr ptr) const noexcept {
-        if (auto [it1, it2] = std::ranges::equal_range(scopes_, ptr, {}, &scope_t::ptr_); it1 != it2) {
+    constexpr std::span<const var_index_t> find_closure_upvalues(flat_stmt_ptr ptr) const noexcept {
+        if (auto [it1, it2] = std::ranges::equal_range(closures_, ptr, {}, &closure_t::ptr_); it1 != it2) {
             const flat_list<var_index_t>& list = it1->upvalues_;
             return std::span(upvalues_).subspan(list.first_.i, list.size());
         }
         return {};
     }
 
-    constexpr std::span<const var_index_t> find_closure_upvalues(flat_stmt_ptr ptr) const noexcept {
-        if (auto [it1, it2] = std::ranges::equal_range(closures_, ptr, {}, &closure_t::ptr_); it1 != it2) {
-            const flat_list<var_index_t>& list = it1->upvalues_;
-            return std::span(upvalues_).subspan(list.first_.i, list.size());
+    constexpr frame_t find_frame(flat_stmt_ptr ptr) const noexcept {
+        if (auto [it1, it2] = std::ranges::equal_range(frames_, ptr, {}, &frame_t::ptr_); it1 != it2) {
+            return *it1;
+        }
+        return {};
+    }
+
+    constexpr var_index_t find_declaration(flat_stmt_ptr ptr) const noexcept {
+        if (auto [it1, it2] = std::ranges::equal_range(declarations_, ptr, {}, &declaration_t::ptr_);
+            it1 != it2 && it1->param_ < 0) {
+            return it1->slot_;
+        }
+        return {};
+    }
+
+    constexpr std::span<const declaration_t> find_params(flat_stmt_ptr ptr) const noexcept {
+        auto [it1, it2] = std::ranges::equal_range(declarations_, ptr, {}, &declaration_t::ptr_);
+        if (it1 != it2 && it1->param_ < 0) {
+            ++it1;  // the function's own declaration
+        }
+        return std::span(it1, it2);
+    }
+
+    constexpr int find_global(std::string_view name) const noexcept {
+        if (auto it = std::ranges::find(globals_, name); it != std::ranges::end(globals_)) {
+            return static_cast<int>(std::distance(std::ranges::begin(globals_), it));
+        }
+        return -1;
+    }
+
+    constexpr bool is_global_decl(flat_stmt_ptr ptr) const noexcept {
+        return std::ranges::binary_search(global_decls_, ptr);
+    }
+
+    constexpr direct_call_t find_direct_call(flat_expr_ptr ptr) const noexcept {
+        if (auto [it1, it2] = std::ranges::equal_range(direct_calls_, ptr, {}, &direct_call_t::ptr_); it1 != it2) {
+            return *it1;
         }
         return {};
     }
@@ -85,15 +176,34 @@ struct basic_bindings_t {
 template <typename B>
 concept _bindings = requires { typename std::remove_reference_t<B>::bindings_tag; };
 
-using bindings_t
-    = basic_bindings_t<std::vector<local_t>, std::vector<scope_t>, std::vector<closure_t>, std::vector<var_index_t>>;
-
-template <std::size_t L, std::size_t S, std::size_t C, std::size_t U>
+using bindings_t = basic_bindings_t<
+    std::vector<local_t>,
+    std::vector<closure_t>,
+    std::vector<var_index_t>,
+    std::vector<frame_t>,
+    std::vector<declaration_t>,
+    std::vector<std::string_view>,
+    std::vector<flat_stmt_ptr>,
+    std::vector<direct_call_t>>;
+
+template <
+    std::size_t L,
+    std::size_t C,
+    std::size_t U,
+    std::size_t F,
+    std::size_t D,
+    std::size_t G,
+    std::size_t GD,
+    std::size_t DC>
 using static_bindings_t = basic_bindings_t<
     std::array<local_t, L>,
-    std::array<scope_t, S>,
     std::array<closure_t, C>,
-    std::array<var_index_t, U>>;
+    std::array<var_index_t, U>,
+    std::array<frame_t, F>,
+    std::array<declaration_t, D>,
+    std::array<std::string_view, G>,
+    std::array<flat_stmt_ptr, GD>,
+    std::array<direct_call_t, DC>>;
 
 class _resolver_base {
 protected:
@@ -101,6 +211,33 @@ protected:
         std::string_view name_;
         bool defined_ = false;
         bool captured_ = false;
+        int depth_ = 0;  // block nesting depth within the context
+        bool in_scope_ = true;
+        flat_stmt_ptr function_ = flat_nullptr;  // the function this entry declares, if any
+    };
+
+    // Entries declared while resolving a block merged into a context, in [first_, last_).
+    struct block_entries_t {
+        flat_stmt_ptr ptr_ = flat_nullptr;
+        std::size_t first_ = 0;
+        std::size_t last_ = 0;
+    };
+
+    // Index of a variable relative to the context it's resolved from, with its env_index_ still
+    // being the position of its entry in the owning context, or in the owning function's closure.
+    // Slots are only known once the owning context ends, since only then is it known which of its
+    // entries are captured, and a closure's once all of the upvalues it captures have slots.
+    struct resolved_t {
+        var_index_t index_;
+        int owner_ = -1;  // id of the owning context or closure, see _resolver_base::context
+    };
+
+    // A reference to a local function, which is either called directly or lets the function escape.
+    // through_ are the functions the reference is made from, up to the one declaring the function.
+    struct function_ref_t {
+        flat_stmt_ptr function_ = flat_nullptr;
+        bool called_ = false;
+        std::vector<flat_stmt_ptr> through_;
     };
 
     struct context {
@@ -115,19 +252,47 @@ protected:
 
         flat_stmt_ptr ptr_ = flat_nullptr;
         type type_;
+        int id_ = -1;
+
+        // Functions also own their closure's upvalues, and only heap-allocate the variables they
+        // capture if they escape.
+        int closure_id_ = -1;
+        bool escapes_ = true;
 
         context* enclosing_ = nullptr;
 
+        // See frame_t::display_size_. A function's environment can also refer to its closure,
+        // and a block's environment to all of the environments its enclosing scope can refer to.
+        std::size_t display_size_ = 1;
+
+        // Like clox's locals, entries of nested blocks are appended to their context's entries,
+        // and go out of scope when the block ends. Inner entries are found first.
+        int scope_depth_ = 0;
         std::vector<scope_entry_t> scope_entries_;
-        std::vector<var_index_t> upvalue_entries_;
+        std::vector<block_entries_t> blocks_;
+        std::vector<resolved_t> upvalue_entries_;
 
         constexpr scope_entry_t* find_entry(std::string_view name) noexcept {
-            auto it = std::ranges::find(scope_entries_, name, &scope_entry_t::name_);
-            return it != std::ranges::end(scope_entries_) ? &*it : nullptr;
+            auto entries = scope_entries_ | std::views::reverse;
+            auto it = std::ranges::find_if(
+                entries, [name](const scope_entry_t& entry) { return entry.in_scope_ && entry.name_ == name; });
+            return it != std::ranges::end(entries) ? &*it : nullptr;
         }
 
-        constexpr void declare_entry(std::string_view name) noexcept {
-            scope_entries_.emplace_back(name, false, false);
+        constexpr int declare_entry(std::string_view name) noexcept {
+            scope_entries_.emplace_back(name, false, false, scope_depth_, true);
+            return static_cast<int>(scope_entries_.size() - 1);
+        }
+
+        constexpr void begin_scope() noexcept { ++scope_depth_; }
+
+        constexpr void end_scope() noexcept {
+            for (scope_entry_t& entry : scope_entries_) {
+                if (entry.depth_ == scope_depth_) {
+                    entry.in_scope_ = false;
+                }
+            }
+            --scope_depth_;
         }
 
         constexpr void define_entry(std::string_view name) noexcept {
@@ -138,20 +303,18 @@ protected:
 
         // example resolve:
         // (1.block) a, b / (2.block) x, y / (3.function) c, d / (4.block) e
+        // 2.block's entries are appended to 1.block's, and 4.block's to 3.function's.
+        // resolve "e" from innermost scope:
+        // - no environment boundary, depth = 0
+        // - entry at index 2 of 3.function
+        // > var_index_t { env_depth_ = 0, env_index_ = 2 }
         // resolve "b" from innermost scope:
-        // - 3 scope boundaries from 4.block to 1.block
-        // - variable at index 1 of 1.block
-        // > var_index_t { env_depth_ = 3, env_index_ = 1 }
-        // function "outer" closure index:
-        // - 2 scope boundaries from 3.function to 1.block
-        // - same variable index = 1
-        // > var_index_t { env_depth_ = 2, env_index_ = 1 }
-        // function "inner" local index:
-        // - 1 scope boundary from 4 to 3, + 1 because the closure is actually
-        //   the function scope's enclosing environment, depth = 2
+        // - 3.function captures "b" from 1.block, at depth 0 and index 1
+        // - the closure is actually the function scope's enclosing environment, depth = 1
         // - this is the first captured variable in 3.function, so index = 0
-        // > var_index_t { env_depth_ = 2, env_index_ = 0 }
-        constexpr var_index_t resolve_local(std::string_view name, bool capture = false) noexcept {
+        // > var_index_t { env_depth_ = 1, env_index_ = 0 }
+        // "b" itself is only moved to the heap if 3.function escapes (capture = true).
+        constexpr resolved_t resolve_local(std::string_view name, bool capture = false) noexcept {
             scope_entry_t* entry = find_entry(name);
             if (entry) {
                 if (capture) {
@@ -159,7 +322,7 @@ protected:
                 }
 
                 int index = static_cast<int>(std::distance(scope_entries_.data(), entry));
-                return { 0, index };
+                return { { 0, index }, id_ };
             }
 
             if (!enclosing_) {
@@ -168,22 +331,23 @@ protected:
 
             if (type_ != type::function) {
                 auto local = enclosing_->resolve_local(name, capture);
-                if (local)
-                    ++local.env_depth_;
+                if (local.index_)
+                    ++local.index_.env_depth_;
                 return local;
             } else {
-                auto upvalue = enclosing_->resolve_local(name, true);
-                if (upvalue) {
+                auto upvalue = enclosing_->resolve_local(name, capture || escapes_);
+                if (upvalue.index_) {
                     int upvalue_index = add_upvalue(upvalue);
                     // Closure upvalues actually live 1 step above the function's root scope.
-                    return { 1, upvalue_index };
+                    return { { 1, upvalue_index }, closure_id_ };
                 }
                 return {};
             }
         }
 
-        constexpr int add_upvalue(var_index_t upvalue) noexcept {
-            if (auto it = std::ranges::find(upvalue_entries_, upvalue); it != upvalue_entries_.end()) {
+        constexpr int add_upvalue(resolved_t upvalue) noexcept {
+            if (auto it = std::ranges::find(upvalue_entries_, upvalue.index_, &resolved_t::index_);
+                it != upvalue_entries_.end()) {
                 return std::distance(upvalue_entries_.begin(), it);
             } else {
                 upvalue_entries_.emplace_back(upvalue);
@@ -191,15 +355,17 @@ protected:
             }
         }
 
-        constexpr std::vector<var_index_t> get_scope_upvalues() const noexcept {
-            std::vector<var_index_t> upvalues;
-            upvalues.reserve(scope_entries_.size());
-            for (const auto& [index, entry] : std::views::enumerate(scope_entries_)) {
-                if (entry.captured_) {
-                    upvalues.emplace_back(0, index);
-                }
+        // Captured and plain variables are numbered separately, in declaration order.
+        constexpr std::vector<var_index_t> get_slots() const noexcept {
+            std::vector<var_index_t> slots;
+            slots.reserve(scope_entries_.size());
+
+            int values = 0;
+            int upvalues = 0;
+            for (const scope_entry_t& entry : scope_entries_) {
+                slots.emplace_back(0, entry.captured_ ? upvalues++ : values++, entry.captured_);
             }
-            return upvalues;
+            return slots;
         }
     };
 };
@@ -210,21 +376,85 @@ class resolver : _resolver_base {
 public:
     constexpr resolver() = default;
 
+    // Functions which are known not to escape (see find_non_escaping()), sorted.
+    constexpr explicit resolver(std::span<const flat_stmt_ptr> non_escaping)
+        : non_escaping_(non_escaping) { }
+
     constexpr bindings_t resolve() && {
         resolve(ast.root_block_);
 
+        // Closures are numbered from the outermost, so the upvalues each one captures already have slots.
+        std::ranges::sort(closure_lists_, {}, &std::pair<int, flat_list<var_index_t>>::first);
+        for (const auto& [id, list] : closure_lists_) {
+            slots_[id] = get_closure_slots(list);
+        }
+
+        for (auto&& [local, owner] : std::views::zip(locals_, local_owners_)) {
+            assign_slot(local.index_, owner);
+        }
+        for (auto&& [upvalue, owner] : std::views::zip(upvalues_, upvalue_owners_)) {
+            assign_slot(upvalue, owner);
+        }
+        for (auto&& [declaration, owner] : std::views::zip(declarations_, declaration_owners_)) {
+            assign_slot(declaration.slot_, owner);
+        }
+
         std::ranges::sort(locals_, {}, &local_t::ptr_);
-        std::ranges::sort(scopes_, {}, &scope_t::ptr_);
         std::ranges::sort(closures_, {}, &closure_t::ptr_);
+        std::ranges::sort(frames_, {}, &frame_t::ptr_);
+        std::ranges::sort(declarations_, {}, &declaration_t::key);
+        std::ranges::sort(global_decls_);
+
+        std::erase_if(direct_calls_, [this](const direct_call_t& call) {
+            return std::ranges::contains(reassigned_functions_, call.function_);
+        });
+        std::ranges::sort(direct_calls_, {}, &direct_call_t::ptr_);
 
         return bindings_t {
             .locals_ = std::move(locals_),
-            .scopes_ = std::move(scopes_),
             .closures_ = std::move(closures_),
             .upvalues_ = std::move(upvalues_),
+            .frames_ = std::move(frames_),
+            .declarations_ = std::move(declarations_),
+            .globals_ = std::move(globals_),
+            .global_decls_ = std::move(global_decls_),
+            .direct_calls_ = std::move(direct_calls_),
         };
     }
 
+    // Reports the static errors of ast, which only takes walking it once, without escape analysis or bindings.
+    constexpr void check() && { resolve(ast.root_block_); }
+
+    // Escape analysis: a local function escapes if it's referenced other than by calling it directly,
+    // or if it's called from within a function which escapes. Functions which don't escape can only
+    // run while the frames they capture variables from are alive, and so can borrow them.
+    constexpr std::vector<flat_stmt_ptr> find_non_escaping() && {
+        resolve(ast.root_block_);
+
+        std::vector<flat_stmt_ptr> escaping;
+        for (const function_ref_t& ref : function_refs_) {
+            if (!ref.called_) {
+                escaping.push_back(ref.function_);
+            }
+        }
+
+        const auto escapes = [&escaping](flat_stmt_ptr function) { return std::ranges::contains(escaping, function); };
+        for (bool changed = true; changed;) {
+            changed = false;
+            for (const function_ref_t& ref : function_refs_) {
+                if (!escapes(ref.function_) && std::ranges::any_of(ref.through_, escapes)) {
+                    escaping.push_back(ref.function_);
+                    changed = true;
+                }
+            }
+        }
+
+        std::vector<flat_stmt_ptr> non_escaping;
+        std::ranges::copy_if(local_functions_, std::back_inserter(non_escaping), std::not_fn(escapes));
+        std::ranges::sort(non_escaping);
+        return non_escaping;
+    }
+
 private:
     constexpr void resolve(flat_stmt_ptr ptr) {
         ast[ptr].visit([this, ptr](const auto& stmt) { (*this)(ptr, stmt); });
@@ -246,6 +476,23 @@ private:
     }
 
     constexpr void operator()(flat_stmt_ptr ptr, const flat_block_stmt& stmt) {
+        // A block which declares nothing gets no frame, and its statements are resolved as if
+        // they were directly in the enclosing scope.
+        if (!declares_variables(stmt.statements_)) {
+            resolve(stmt.statements_);
+            return;
+        }
+
+        // Blocks nested in another scope take up slots in its frame, rather than having an environment.
+        if (ctx_) {
+            const std::size_t first = ctx_->scope_entries_.size();
+            ctx_->begin_scope();
+            resolve(stmt.statements_);
+            ctx_->end_scope();
+            ctx_->blocks_.emplace_back(ptr, first, ctx_->scope_entries_.size());
+            return;
+        }
+
         context ctx(ptr, context::type::scope);
 
         begin_ctx(ctx);
@@ -258,7 +505,8 @@ private:
     constexpr void operator()(flat_stmt_ptr, const flat_expression_stmt& stmt) { resolve(stmt.expression_); }
 
     constexpr void operator()(flat_stmt_ptr ptr, const flat_function_stmt& stmt) {
-        declare(stmt.name_);
+        declare_global(ptr, stmt.name_);
+        declare(ptr, stmt.name_);
         define(stmt.name_);
 
         resolve_function(ptr, stmt);
@@ -278,8 +526,9 @@ private:
         }
     }
 
-    constexpr void operator()(flat_stmt_ptr, const flat_var_stmt& stmt) {
-        declare(stmt.name_);
+    constexpr void operator()(flat_stmt_ptr ptr, const flat_var_stmt& stmt) {
+        declare_global(ptr, stmt.name_);
+        declare(ptr, stmt.name_);
         if (stmt.initializer_ != flat_nullptr) {
             resolve(stmt.initializer_);
         }
@@ -294,6 +543,11 @@ private:
     constexpr void operator()(flat_expr_ptr ptr, const flat_assign_expr& expr) {
         resolve(expr.value_);
         resolve_local(ptr, expr.name_);
+
+        const scope_entry_t* entry = find_scope_entry(expr.name_.lexeme_);
+        if (entry && entry->function_ != flat_nullptr) {
+            reassigned_functions_.push_back(entry->function_);
+        }
     }
 
     constexpr void operator()(flat_expr_ptr, const flat_binary_expr& expr) {
@@ -302,6 +556,7 @@ private:
     }
 
     constexpr void operator()(flat_expr_ptr, const flat_call_expr& expr) {
+        callee_ = expr.callee_;
         resolve(expr.callee_);
         resolve(expr.arguments_);
     }
@@ -325,10 +580,22 @@ private:
         }
 
         resolve_local(ptr, expr.name_);
+        add_function_ref(ptr, expr.name_.lexeme_);
     }
 
     constexpr void begin_ctx(context& ctx) {
         ctx.enclosing_ = std::exchange(ctx_, &ctx);
+        ctx.id_ = static_cast<int>(slots_.size());
+        slots_.emplace_back();
+
+        if (ctx.type_ == context::type::function) {
+            ctx.closure_id_ = static_cast<int>(slots_.size());
+            slots_.emplace_back();
+            ctx.escapes_ = !std::ranges::binary_search(non_escaping_, ctx.ptr_);
+            ctx.display_size_ = 2;
+        } else if (ctx.enclosing_) {
+            ctx.display_size_ = ctx.enclosing_->display_size_ + 1;
+        }
     }
 
     constexpr void end_ctx(context& ctx) {
@@ -339,25 +606,111 @@ private:
             if (!ctx.upvalue_entries_.empty()) {
                 flat_list<var_index_t> list = append_upvalues(ctx.upvalue_entries_);
                 closures_.emplace_back(ctx.ptr_, list);
+                closure_lists_.emplace_back(ctx.closure_id_, list);
             }
         }
 
-        auto upvalues = ctx.get_scope_upvalues();
-        if (!upvalues.empty()) {
-            flat_list<var_index_t> list = append_upvalues(upvalues);
-            scopes_.emplace_back(ctx.ptr_, list);
+        std::vector<var_index_t>& slots = slots_[ctx.id_];
+        slots = ctx.get_slots();
+
+        const auto count_upvalues = [](std::span<const var_index_t> range) {
+            return static_cast<std::size_t>(std::ranges::count_if(range, &var_index_t::captured_));
+        };
+
+        const std::size_t upvalues = count_upvalues(slots);
+        frames_.emplace_back(ctx.ptr_, slots.size() - upvalues, upvalues, ctx.display_size_);
+
+        for (const block_entries_t& block : ctx.blocks_) {
+            const std::span<const var_index_t> before = std::span(slots).first(block.first_);
+            const std::span<const var_index_t> within
+                = std::span(slots).subspan(block.first_, block.last_ - block.first_);
+            frames_.push_back({
+                .ptr_ = block.ptr_,
+                .values_size_ = within.size() - count_upvalues(within),
+                .upvalues_size_ = count_upvalues(within),
+                .display_size_ = ctx.display_size_,
+                .merged_ = true,
+                .values_first_ = before.size() - count_upvalues(before),
+                .upvalues_first_ = count_upvalues(before),
+            });
         }
     }
 
-    constexpr void declare(const token_t& name) {
+    constexpr void declare(flat_stmt_ptr ptr, const token_t& name, int param = -1) {
         if (!ctx_)
             return;
 
-        if (ctx_->find_entry(name.lexeme_)) {
+        if (scope_entry_t* entry = ctx_->find_entry(name.lexeme_); entry && entry->depth_ == ctx_->scope_depth_) {
             throw parse_error(name, "Already a variable with this name in this scope.");
         }
 
-        ctx_->declare_entry(name.lexeme_);
+        const int entry = ctx_->declare_entry(name.lexeme_);
+        declarations_.emplace_back(ptr, param, var_index_t { 0, entry });
+        declaration_owners_.push_back(ctx_->id_);
+
+        if (param < 0 && ast[ptr].template holds<flat_function_stmt>()) {
+            ctx_->scope_entries_[entry].function_ = ptr;
+            local_functions_.push_back(ptr);
+        }
+    }
+
+    // Replaces the entry index of a resolved variable with its slot in the owning context or closure.
+    constexpr void assign_slot(var_index_t& index, int owner) const {
+        const var_index_t& slot = slots_[owner][index.env_index_];
+        index.env_index_ = slot.env_index_;
+        index.captured_ = slot.captured_;
+        index.borrowed_ = slot.borrowed_;
+    }
+
+    // A closure shares the upvalues which are captured on the heap, and borrows the others.
+    // Both are numbered separately, in the order they are captured.
+    constexpr std::vector<var_index_t> get_closure_slots(flat_list<var_index_t> list) const {
+        std::vector<var_index_t> slots;
+        slots.reserve(list.size());
+
+        int upvalues = 0;
+        int borrowed = 0;
+        for (std::size_t i = list.first_.i; i < list.last_.i; ++i) {
+            const bool captured = slots_[upvalue_owners_[i]][upvalues_[i].env_index_].captured_;
+            slots.emplace_back(0, captured ? upvalues++ : borrowed++, captured, !captured);
+        }
+        return slots;
+    }
+
+    // Finds the entry a name refers to, in the innermost context which declares it.
+    constexpr const scope_entry_t* find_scope_entry(std::string_view name) const {
+        for (context* ctx = ctx_; ctx; ctx = ctx->enclosing_) {
+            if (const scope_entry_t* entry = ctx->find_entry(name)) {
+                return entry;
+            }
+        }
+        return nullptr;
+    }
+
+    constexpr void add_function_ref(flat_expr_ptr ptr, std::string_view name) {
+        std::vector<flat_stmt_ptr> through;
+        for (context* ctx = ctx_; ctx; ctx = ctx->enclosing_) {
+            if (const scope_entry_t* entry = ctx->find_entry(name)) {
+                if (entry->function_ == flat_nullptr)
+                    return;
+
+                if (ptr == callee_) {
+                    direct_calls_.emplace_back(ptr, entry->function_, std::ranges::contains(through, entry->function_));
+                }
+                function_refs_.emplace_back(entry->function_, ptr == callee_, std::move(through));
+                return;
+            }
+
+            if (ctx->type_ == context::type::function) {
+                through.push_back(ctx->ptr_);
+            }
+        }
+    }
+
+    constexpr bool declares_variables(flat_stmt_list stmts) const {
+        return std::ranges::any_of(stmts, [](flat_stmt_ptr stmt) {
+            return ast[stmt].template holds<flat_var_stmt>() || ast[stmt].template holds<flat_function_stmt>();
+        });
     }
 
     constexpr void define(const token_t& name) {
@@ -370,8 +723,8 @@ private:
     constexpr void resolve_function(flat_stmt_ptr ptr, const flat_function_stmt& function) {
         context ctx(ptr, context::type::function);
         begin_ctx(ctx);
-        for (const token_t& param : ast.range(function.params_)) {
-            declare(param);
+        for (const auto& [index, param] : std::views::enumerate(ast.range(function.params_))) {
+            declare(ptr, param, static_cast<int>(index));
             define(param);
         }
         resolve(function.body_);
@@ -379,62 +732,136 @@ private:
     }
 
     constexpr void resolve_local(flat_expr_ptr ptr, const token_t& name) {
-        if (!ctx_)
+        auto resolved = ctx_ ? ctx_->resolve_local(name.lexeme_) : resolved_t {};
+        if (resolved.index_) {
+            locals_.emplace_back(ptr, resolved.index_);
+            local_owners_.push_back(resolved.owner_);
+        } else {
+            add_global(name.lexeme_);
+        }
+    }
+
+    constexpr void declare_global(flat_stmt_ptr ptr, const token_t& name) {
+        if (ctx_)
             return;
 
-        auto var_index = ctx_->resolve_local(name.lexeme_);
-        if (var_index) {
-            locals_.emplace_back(ptr, var_index);
+        add_global(name.lexeme_);
+        global_decls_.push_back(ptr);
+    }
+
+    constexpr void add_global(std::string_view name) {
+        if (std::ranges::find(globals_, name) == globals_.end()) {
+            globals_.push_back(name);
         }
     }
 
-    constexpr flat_list<var_index_t> append_upvalues(const std::vector<var_index_t>& upvalues) {
+    constexpr flat_list<var_index_t> append_upvalues(const std::vector<resolved_t>& upvalues) {
         flat_list<var_index_t> list = {
             .first_ = { upvalues_.size() },
             .last_ = { upvalues_.size() + upvalues.size() },
         };
-        upvalues_.append_range(upvalues);
+        for (const resolved_t& upvalue : upvalues) {
+            upvalues_.push_back(upvalue.index_);
+            upvalue_owners_.push_back(upvalue.owner_);
+        }
         return list;
     }
 
     std::vector<local_t> locals_;
-    std::vector<scope_t> scopes_;
     std::vector<closure_t> closures_;
     std::vector<var_index_t> upvalues_;
+    std::vector<frame_t> frames_;
+    std::vector<declaration_t> declarations_;
+    std::vector<std::string_view> globals_;
+    std::vector<flat_stmt_ptr> global_decls_;
+
+    // Owning contexts of locals_, upvalues_ and declarations_ (see resolved_t),
+    // and the slots of each context's entries.
+    std::vector<int> local_owners_;
+    std::vector<int> upvalue_owners_;
+    std::vector<int> declaration_owners_;
+    std::vector<std::vector<var_index_t>> slots_;
+    std::vector<std::pair<int, flat_list<var_index_t>>> closure_lists_;
+
+    // Escape analysis
+    std::span<const flat_stmt_ptr> non_escaping_;
+    std::vector<flat_stmt_ptr> local_functions_;
+    std::vector<function_ref_t> function_refs_;
+    flat_expr_ptr callee_ = flat_nullptr;
+
+    // Direct calls
+    std::vector<direct_call_t> direct_calls_;
+    std::vector<flat_stmt_ptr> reassigned_functions_;
 
     context* ctx_ = nullptr;
 };
 
+// The local functions of ast which don't escape, found once for every pass which resolves ast.
+// There are at most as many as ast has statements.
+template <const auto& ast>
+    requires _flat_ast<decltype(ast)>
+constexpr auto _non_escaping_storage = [] {
+    const std::vector<flat_stmt_ptr> non_escaping = resolver<ast>().find_non_escaping();
+    std::array<flat_stmt_ptr, ast.statements_.size()> functions {};
+    std::ranges::copy(non_escaping, functions.begin());
+    return std::pair { functions, non_escaping.size() };
+}();
+
+template <const auto& ast>
+constexpr std::span<const flat_stmt_ptr> _non_escaping_v =
+    std::span(_non_escaping_storage<ast>.first).first(_non_escaping_storage<ast>.second);
+
 template <const auto& ast>
 constexpr bindings_t resolve() {
-    return resolver<ast>().resolve();
+    return resolver<ast>(_non_escaping_v<ast>).resolve();
+}
+
+// Reports the static errors of ast, in a single resolver pass. Pruning removes code (see static_prune),
+// so programs are checked before they're pruned, and only resolved after.
+template <const auto& ast>
+    requires _flat_ast<decltype(ast)>
+constexpr bool static_check() {
+    resolver<ast>().check();
+    return true;
 }
 
 template <const auto& ast>
 constexpr _bindings auto static_resolve() {
-    constexpr std::array<std::size_t, 4> sizes = [] {
+    constexpr std::array<std::size_t, 8> sizes = [] {
         bindings_t bindings = resolve<ast>();
         return std::array {
             bindings.locals_.size(),
-            bindings.scopes_.size(),
             bindings.closures_.size(),
             bindings.upvalues_.size(),
+            bindings.frames_.size(),
+            bindings.declarations_.size(),
+            bindings.globals_.size(),
+            bindings.global_decls_.size(),
+            bindings.direct_calls_.size(),
         };
     }();
 
     constexpr std::size_t L = sizes[0];
-    constexpr std::size_t S = sizes[1];
-    constexpr std::size_t C = sizes[2];
-    constexpr std::size_t U = sizes[3];
+    constexpr std::size_t C = sizes[1];
+    constexpr std::size_t U = sizes[2];
+    constexpr std::size_t F = sizes[3];
+    constexpr std::size_t D = sizes[4];
+    constexpr std::size_t G = sizes[5];
+    constexpr std::size_t GD = sizes[6];
+    constexpr std::size_t DC = sizes[7];
 
     return [] {
         bindings_t bindings = resolve<ast>();
 
-        static_bindings_t<L, S, C, U> static_bindings;
+        static_bindings_t<L, C, U, F, D, G, GD, DC> static_bindings;
         std::ranges::copy(bindings.locals_, static_bindings.locals_.begin());
-        std::ranges::copy(bindings.scopes_, static_bindings.scopes_.begin());
         std::ranges::copy(bindings.closures_, static_bindings.closures_.begin());
         std::ranges::copy(bindings.upvalues_, static_bindings.upvalues_.begin());
+        std::ranges::copy(bindings.frames_, static_bindings.frames_.begin());
+        std::ranges::copy(bindings.declarations_, static_bindings.declarations_.begin());
+        std::ranges::copy(bindings.globals_, static_bindings.globals_.begin());
+        std::ranges::copy(bindings.global_decls_, static_bindings.global_decls_.begin());
+        std::ranges::copy(bindings.direct_calls_, static_bindings.direct_calls_.begin());
         return static_bindings;
     }();
 }
@@ -0,0 +1,77 @@
+#pragma once
+
+#include <cstddef>
+#include <utility>
+
+namespace ctlox::v2 {
+
+// Counters of a program's memory use, see program_options_t::memory_stats_. The heap's sizes are always
+// reported, the other counters are only recorded if ctlox is built with CTLOX_STATS.
+struct memory_stats_t {
+    // heap_t entries: live at the end of the program and at most, and freed ones waiting to be reused.
+    std::size_t live_entries_ = 0;
+    std::size_t peak_entries_ = 0;
+    std::size_t free_entries_ = 0;
+
+    // Calls to heap_t::create() and heap_t::release().
+    std::size_t creates_ = 0;
+    std::size_t releases_ = 0;
+
+    // Local environments constructed, including closures.
+    std::size_t frames_ = 0;
+
+    // References taken on string and function objects, i.e. copies of the values holding them.
+    std::size_t string_copies_ = 0;
+    std::size_t function_copies_ = 0;
+};
+
+#ifdef CTLOX_STATS
+inline constexpr bool memory_stats_enabled = true;
+#else
+inline constexpr bool memory_stats_enabled = false;
+#endif
+
+// Stats of the program running on this thread, if it records any. Values don't know which program
+// they belong to, so counters are found through here rather than through the program's state.
+inline thread_local memory_stats_t* _thread_memory_stats = nullptr;
+
+// Records into the stats of the running program. This compiles to nothing without CTLOX_STATS,
+// and nothing is recorded during constant evaluation.
+template <typename Fn>
+constexpr void _record_stats(Fn&& fn) {
+    if constexpr (memory_stats_enabled) {
+        if !consteval {
+            if (_thread_memory_stats) {
+                fn(*_thread_memory_stats);
+            }
+        }
+    }
+}
+
+// Records into stats for the rest of the scope, on this thread.
+class _memory_stats_scope {
+public:
+    constexpr explicit _memory_stats_scope(memory_stats_t* stats) noexcept {
+        if constexpr (memory_stats_enabled) {
+            if !consteval {
+                previous_ = std::exchange(_thread_memory_stats, stats);
+            }
+        }
+    }
+
+    _memory_stats_scope(const _memory_stats_scope&) = delete;
+    _memory_stats_scope& operator=(const _memory_stats_scope&) = delete;
+
+    constexpr ~_memory_stats_scope() noexcept {
+        if constexpr (memory_stats_enabled) {
+            if !consteval {
+                _thread_memory_stats = previous_;
+            }
+        }
+    }
+
+private:
+    memory_stats_t* previous_ = nullptr;
+};
+
+}  // namespace ctlox::v2
\ No newline at end of file
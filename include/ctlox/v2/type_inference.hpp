@@ -0,0 +1,359 @@
+#pragma once
+
+#include <ctlox/v2/expression.hpp>
+#include <ctlox/v2/flat_ast.hpp>
+#include <ctlox/v2/literal.hpp>
+#include <ctlox/v2/statement.hpp>
+
+#include <algorithm>
+#include <array>
+#include <cstddef>
+#include <iterator>
+#include <ranges>
+#include <string_view>
+#include <type_traits>
+#include <utility>
+#include <variant>
+#include <vector>
+
+namespace ctlox::v2 {
+
+// Type of every value an expression can evaluate to, as far as type inference can tell (see type_inferrer).
+// none is the type of expressions which can't produce any value yet, and is refined as inference goes on.
+enum class static_type_t : unsigned char {
+    none,
+    number,
+    boolean,
+    unknown,
+};
+
+constexpr static_type_t _join_types(static_type_t lhs, static_type_t rhs) noexcept {
+    if (lhs == static_type_t::none)
+        return rhs;
+    if (rhs == static_type_t::none || lhs == rhs)
+        return lhs;
+    return static_type_t::unknown;
+}
+
+template <typename Types>
+struct basic_types_t {
+    using types_tag = void;
+
+    // Indexed by expression.
+    Types types_;
+
+    [[nodiscard]] constexpr static_type_t type_of(flat_expr_ptr ptr) const noexcept { return types_[ptr.i]; }
+    [[nodiscard]] constexpr bool is_number(flat_expr_ptr ptr) const noexcept {
+        return type_of(ptr) == static_type_t::number;
+    }
+};
+
+template <typename T>
+concept _types = requires { typename std::remove_reference_t<T>::types_tag; };
+
+using types_t = basic_types_t<std::vector<static_type_t>>;
+
+template <std::size_t N>
+using static_types_t = basic_types_t<std::array<static_type_t, N>>;
+
+// Infers the types of expressions from the values which flow into local variables. Globals can be redefined
+// by natives, parameters hold whatever their function is called with, and calls return anything, so their
+// values are unknown; except for local functions which are only ever called directly: all of their calls
+// are known, so their parameters are typed from their arguments, and their calls from their returns.
+// Types are refined until nothing changes, starting from none.
+template <const auto& ast>
+    requires _flat_ast<decltype(ast)>
+class type_inferrer {
+public:
+    constexpr types_t infer() && {
+        types_.types_.resize(ast.expressions_.size(), static_type_t::none);
+
+        do {
+            changed_ = false;
+            resolve(ast.root_block_);
+        } while (changed_);
+
+        return std::move(types_);
+    }
+
+    constexpr void operator()(flat_stmt_ptr, const flat_block_stmt& stmt) {
+        scopes_.emplace_back();
+        resolve(stmt.statements_);
+        scopes_.pop_back();
+    }
+
+    constexpr void operator()(flat_stmt_ptr, const flat_break_stmt&) { }
+
+    constexpr void operator()(flat_stmt_ptr, const flat_expression_stmt& stmt) { infer(stmt.expression_); }
+
+    constexpr void operator()(flat_stmt_ptr ptr, const flat_function_stmt& stmt) {
+        // Global functions aren't tracked, but their locals are.
+        const int function = scopes_.empty() ? -1 : declare(stmt.name_.lexeme_, symbol_for(ptr, -1));
+        if (function >= 0) {
+            symbols_[function].function_ = true;
+        }
+
+        functions_.push_back(function);
+        scopes_.emplace_back();
+
+        for (int i = 0; const token_t& param : ast.range(stmt.params_)) {
+            const int symbol = declare(param.lexeme_, symbol_for(ptr, i++));
+            symbols_[symbol].owner_ = function;
+            if (function < 0 || !symbols_[function].only_called_) {
+                update(symbols_[symbol].type_, static_type_t::unknown);
+            }
+        }
+
+        resolve(stmt.body_);
+
+        // Falling off the end of the function returns nil.
+        const bool returns_last = !stmt.body_.empty()
+            && ast[stmt.body_[stmt.body_.size() - 1]].template holds<flat_return_stmt>();
+        if (function >= 0 && !returns_last) {
+            update(symbols_[function].returns_, static_type_t::unknown);
+        }
+
+        scopes_.pop_back();
+        functions_.pop_back();
+    }
+
+    constexpr void operator()(flat_stmt_ptr, const flat_if_stmt& stmt) {
+        infer(stmt.condition_);
+        resolve(stmt.then_branch_);
+        if (stmt.else_branch_ != flat_nullptr) {
+            resolve(stmt.else_branch_);
+        }
+    }
+
+    constexpr void operator()(flat_stmt_ptr, const flat_return_stmt& stmt) {
+        const static_type_t type = stmt.value_ != flat_nullptr ? infer(stmt.value_) : static_type_t::unknown;
+        if (!functions_.empty() && functions_.back() >= 0) {
+            update(symbols_[functions_.back()].returns_, type);
+        }
+    }
+
+    constexpr void operator()(flat_stmt_ptr ptr, const flat_var_stmt& stmt) {
+        const static_type_t type =
+            stmt.initializer_ != flat_nullptr ? infer(stmt.initializer_) : static_type_t::unknown;
+        if (!scopes_.empty()) {
+            const int symbol = declare(stmt.name_.lexeme_, symbol_for(ptr, -1));
+            update(symbols_[symbol].type_, type);
+        }
+    }
+
+    constexpr void operator()(flat_stmt_ptr, const flat_while_stmt& stmt) {
+        infer(stmt.condition_);
+        resolve(stmt.body_);
+    }
+
+    constexpr static_type_t operator()(flat_expr_ptr, const flat_assign_expr& expr) {
+        const static_type_t type = infer(expr.value_);
+        if (const int symbol = find(expr.name_.lexeme_); symbol >= 0) {
+            if (symbols_[symbol].function_) {
+                escape(symbol);
+            }
+            update(symbols_[symbol].type_, type);
+        }
+        return type;
+    }
+
+    constexpr static_type_t operator()(flat_expr_ptr, const flat_binary_expr& expr) {
+        const static_type_t left = infer(expr.left_);
+        const static_type_t right = infer(expr.right_);
+
+        switch (expr.operator_.type_) {
+        case token_type::minus:
+        case token_type::slash:
+        case token_type::star:
+            return static_type_t::number;
+        case token_type::plus:
+            // Adding anything to a number either fails or makes a number.
+            if (left == static_type_t::number || right == static_type_t::number)
+                return static_type_t::number;
+            if (left == static_type_t::none || right == static_type_t::none)
+                return static_type_t::none;
+            return static_type_t::unknown;
+        default:
+            return static_type_t::boolean;
+        }
+    }
+
+    constexpr static_type_t operator()(flat_expr_ptr, const flat_call_expr& expr) {
+        const int function = called_function(expr.callee_);
+        if (function < 0) {
+            infer(expr.callee_);
+        } else {
+            set_type(expr.callee_, static_type_t::unknown);
+        }
+
+        for (int i = 0; flat_expr_ptr argument : expr.arguments_) {
+            const static_type_t type = infer(argument);
+            if (function >= 0 && symbols_[function].only_called_) {
+                if (const int param = find_symbol(symbols_[function].ptr_, i); param >= 0) {
+                    update(symbols_[param].type_, type);
+                }
+            }
+            ++i;
+        }
+
+        if (function >= 0 && symbols_[function].only_called_)
+            return symbols_[function].returns_;
+        return static_type_t::unknown;
+    }
+
+    constexpr static_type_t operator()(flat_expr_ptr, const flat_grouping_expr& expr) { return infer(expr.expr_); }
+
+    constexpr static_type_t operator()(flat_expr_ptr, const flat_literal_expr& expr) {
+        if (std::holds_alternative<double>(expr.value_))
+            return static_type_t::number;
+        if (std::holds_alternative<bool>(expr.value_))
+            return static_type_t::boolean;
+        return static_type_t::unknown;
+    }
+
+    constexpr static_type_t operator()(flat_expr_ptr, const flat_logical_expr& expr) {
+        const static_type_t left = infer(expr.left_);
+        return _join_types(left, infer(expr.right_));
+    }
+
+    constexpr static_type_t operator()(flat_expr_ptr, const flat_unary_expr& expr) {
+        infer(expr.right_);
+        return expr.operator_.type_ == token_type::minus ? static_type_t::number : static_type_t::boolean;
+    }
+
+    constexpr static_type_t operator()(flat_expr_ptr, const flat_variable_expr& expr) {
+        const int symbol = find(expr.name_.lexeme_);
+        if (symbol < 0)
+            return static_type_t::unknown;
+
+        // A function read other than to be called can be called from anywhere.
+        if (symbols_[symbol].function_) {
+            escape(symbol);
+            return static_type_t::unknown;
+        }
+        return symbols_[symbol].type_;
+    }
+
+private:
+    // A local variable, parameter or function.
+    struct symbol_t {
+        flat_stmt_ptr ptr_ = flat_nullptr;
+        int param_ = -1;
+        static_type_t type_ = static_type_t::none;
+
+        bool function_ = false;
+        bool only_called_ = true;
+        static_type_t returns_ = static_type_t::none;
+
+        int owner_ = -1;  // the function a parameter belongs to
+    };
+
+    struct scope_t {
+        std::vector<std::pair<std::string_view, int>> names_;
+    };
+
+    constexpr void resolve(flat_stmt_list stmts) {
+        for (flat_stmt_ptr ptr : stmts) {
+            resolve(ptr);
+        }
+    }
+
+    constexpr void resolve(flat_stmt_ptr ptr) {
+        ast[ptr].visit([this, ptr](const auto& stmt) { (*this)(ptr, stmt); });
+    }
+
+    constexpr static_type_t infer(flat_expr_ptr ptr) {
+        const static_type_t type = ast[ptr].visit([this, ptr](const auto& expr) { return (*this)(ptr, expr); });
+        set_type(ptr, type);
+        return type;
+    }
+
+    constexpr void set_type(flat_expr_ptr ptr, static_type_t type) { types_.types_[ptr.i] = type; }
+
+    constexpr void update(static_type_t& type, static_type_t with) {
+        const static_type_t joined = _join_types(type, with);
+        if (joined != type) {
+            type = joined;
+            changed_ = true;
+        }
+    }
+
+    constexpr int find_symbol(flat_stmt_ptr ptr, int param) const {
+        const auto it = std::ranges::find_if(
+            symbols_, [=](const symbol_t& symbol) { return symbol.ptr_ == ptr && symbol.param_ == param; });
+        return it != symbols_.end() ? static_cast<int>(std::distance(symbols_.begin(), it)) : -1;
+    }
+
+    // Symbols persist between passes, so that what's known about them keeps being refined.
+    constexpr int symbol_for(flat_stmt_ptr ptr, int param) {
+        if (const int symbol = find_symbol(ptr, param); symbol >= 0)
+            return symbol;
+
+        symbols_.push_back({ .ptr_ = ptr, .param_ = param });
+        return static_cast<int>(symbols_.size() - 1);
+    }
+
+    constexpr int declare(std::string_view name, int symbol) {
+        scopes_.back().names_.emplace_back(name, symbol);
+        return symbol;
+    }
+
+    // Like the resolver, finds the innermost local declared so far, or -1 for globals.
+    constexpr int find(std::string_view name) const {
+        for (const scope_t& scope : scopes_ | std::views::reverse) {
+            for (const auto& [scope_name, symbol] : scope.names_ | std::views::reverse) {
+                if (scope_name == name)
+                    return symbol;
+            }
+        }
+        return -1;
+    }
+
+    constexpr int called_function(flat_expr_ptr callee) const {
+        const flat_variable_expr* variable = ast[callee].template get_if<flat_variable_expr>();
+        if (!variable)
+            return -1;
+
+        const int symbol = find(variable->name_.lexeme_);
+        return symbol >= 0 && symbols_[symbol].function_ ? symbol : -1;
+    }
+
+    constexpr void escape(int function) {
+        if (!symbols_[function].only_called_)
+            return;
+
+        symbols_[function].only_called_ = false;
+        changed_ = true;
+        for (symbol_t& symbol : symbols_) {
+            if (symbol.owner_ == function) {
+                symbol.type_ = static_type_t::unknown;
+            }
+        }
+    }
+
+    types_t types_;
+    std::vector<symbol_t> symbols_;
+    std::vector<scope_t> scopes_;
+    std::vector<int> functions_;  // symbols of the functions being resolved, -1 for globals
+    bool changed_ = false;
+};
+
+template <const auto& ast>
+constexpr types_t infer_types() {
+    return type_inferrer<ast>().infer();
+}
+
+template <const auto& ast>
+constexpr auto static_infer_types() {
+    constexpr std::size_t N = std::size(ast.expressions_);
+
+    return [] {
+        const types_t types = infer_types<ast>();
+
+        static_types_t<N> static_types;
+        std::ranges::copy(types.types_, static_types.types_.begin());
+        return static_types;
+    }();
+}
+
+}  // namespace ctlox::v2
\ No newline at end of file
@@ -2,21 +2,306 @@
 
 #include <ctlox/v2/function.hpp>
 #include <ctlox/v2/literal.hpp>
+#include <ctlox/v2/lox_string.hpp>
+#include <ctlox/v2/object.hpp>
 
+#include <bit>
+#include <concepts>
+#include <cstdint>
+#include <functional>
 #include <string>
+#include <string_view>
+#include <type_traits>
 #include <variant>
 
 namespace ctlox::v2 {
 
+// Pointer-like result of value_t::get_if, for alternatives which aren't stored as-is in memory.
+template <typename T>
+class _inline_ptr final {
+public:
+    constexpr _inline_ptr() noexcept = default;
+    constexpr explicit _inline_ptr(T value) noexcept
+        : value_(std::move(value))
+        , engaged_(true) { }
+
+    constexpr const T& operator*() const noexcept { return value_; }
+    constexpr const T* operator->() const noexcept { return &value_; }
+    constexpr explicit operator bool() const noexcept { return engaged_; }
+
+private:
+    T value_ {};
+    bool engaged_ = false;
+};
+
+// The alternatives of a value_t, in order (see _value_index_v). Strings are held as lox_string.
+using _value_variant_t = std::variant<nil_t, bool, double, lox_string, function>;
+
+#ifdef CTLOX_NAN_BOXING
+
+// NaN-boxed representation: every value fits in 8 bytes.
+//
+// Doubles are stored inline, offset by 2^49 so that every encoded double has a non-zero
+// high word (NaNs are canonicalized so that the offset never overflows). Anything below
+// the offset is either an immediate (nil = 0, false, true) or a pointer to a ref-counted
+// object: a string's _boxed_object, or a function's implementation. This assumes 48-bit
+// user-space pointers.
+//
+// Pointers can't be inspected as integers during constant evaluation, so there every
+// non-nil value is boxed into an object instead, and object_ is the active member.
+// A value_t is never shared between constant evaluation and runtime, with the exception
+// of constant-initialized nils, which are a null object_ and read back as nil bits.
+class value_t final {
+    static constexpr std::uint64_t nil_bits = 0;
+    static constexpr std::uint64_t false_bits = 2;
+    static constexpr std::uint64_t true_bits = 3;
+    static constexpr std::uint64_t double_offset = std::uint64_t(1) << 49;
+    static constexpr std::uint64_t canonical_nan = 0x7ff8'0000'0000'0000;
+
+    union {
+        std::uint64_t bits_;
+        _object_base* object_;
+    };
+
+public:
+    constexpr value_t() noexcept { set_nil(); }
+
+    constexpr explicit(false) value_t(nil_t) noexcept { set_nil(); }  // NOLINT(*-explicit-constructor)
+
+    template <typename T>
+        requires std::same_as<std::remove_cvref_t<T>, bool>
+    constexpr explicit(false) value_t(T b) noexcept {  // NOLINT(*-explicit-constructor)
+        if consteval {
+            object_ = _new_object<_boxed_object<bool>>(_value_index_v<bool>, b);
+        } else {
+            bits_ = b ? true_bits : false_bits;
+        }
+    }
+
+    template <typename T>
+        requires std::same_as<std::remove_cvref_t<T>, double>
+    constexpr explicit(false) value_t(T number) noexcept {  // NOLINT(*-explicit-constructor)
+        if consteval {
+            object_ = _new_object<_boxed_object<double>>(_value_index_v<double>, number);
+        } else {
+            const std::uint64_t raw = number != number ? canonical_nan : std::bit_cast<std::uint64_t>(number);
+            bits_ = raw + double_offset;
+        }
+    }
+
+    constexpr explicit(false) value_t(lox_string string) noexcept {  // NOLINT(*-explicit-constructor)
+        set_object(std::move(string).release());
+    }
+
+    constexpr explicit(false) value_t(std::string string)  // NOLINT(*-explicit-constructor)
+        : value_t(lox_string(std::move(string))) { }
+
+    constexpr explicit(false) value_t(const char* string)  // NOLINT(*-explicit-constructor)
+        : value_t(lox_string(string)) { }
+
+    constexpr explicit(false) value_t(function fn) noexcept {  // NOLINT(*-explicit-constructor)
+        set_object(std::move(fn).release());
+    }
+
+    constexpr value_t(const value_t& other) noexcept {
+        if consteval {
+            object_ = other.object_;
+        } else {
+            bits_ = other.bits_;
+        }
+
+        if (_object_base* object = get_object())
+            object->acquire();
+    }
+
+    constexpr value_t(value_t&& other) noexcept {
+        if consteval {
+            object_ = std::exchange(other.object_, nullptr);
+        } else {
+            bits_ = std::exchange(other.bits_, nil_bits);
+        }
+    }
+
+    constexpr value_t& operator=(const value_t& other) noexcept {
+        value_t tmp(other);
+        swap(*this, tmp);
+        return *this;
+    }
+
+    constexpr value_t& operator=(value_t&& other) noexcept {
+        value_t tmp(std::move(other));
+        swap(*this, tmp);
+        return *this;
+    }
+
+    constexpr ~value_t() noexcept {
+        if (_object_base* object = get_object())
+            object->release();
+    }
+
+    friend constexpr void swap(value_t& lhs, value_t& rhs) noexcept {
+        if consteval {
+            std::swap(lhs.object_, rhs.object_);
+        } else {
+            std::swap(lhs.bits_, rhs.bits_);
+        }
+    }
+
+    template <typename Visitor>
+    constexpr auto visit(Visitor&& v) const {
+        switch (index()) {
+        case _value_index_v<bool>:
+            return std::invoke(std::forward<Visitor>(v), *get_if<bool>());
+        case _value_index_v<double>:
+            return std::invoke(std::forward<Visitor>(v), *get_if<double>());
+        case _value_index_v<std::string>:
+            return std::invoke(std::forward<Visitor>(v), *get_if<std::string>());
+        case _value_index_v<function>:
+            return std::invoke(std::forward<Visitor>(v), *get_if<function>());
+        default:
+            return std::invoke(std::forward<Visitor>(v), nil);
+        }
+    }
+
+    template <typename Value>
+    [[nodiscard]] constexpr bool holds() const noexcept {
+        return index() == _value_index_v<Value>;
+    }
+
+    template <typename Value>
+    [[nodiscard]] constexpr auto get_if() const noexcept {
+        if constexpr (std::same_as<Value, nil_t>) {
+            return holds<nil_t>() ? &nil : nullptr;
+        }
+
+        else if constexpr (std::same_as<Value, bool> || std::same_as<Value, double>) {
+            if (!holds<Value>())
+                return _inline_ptr<Value>();
+
+            if consteval {
+                return _inline_ptr<Value>(static_cast<const _boxed_object<Value>*>(object_)->value_);
+            } else {
+                if constexpr (std::same_as<Value, bool>)
+                    return _inline_ptr<bool>(bits_ == true_bits);
+                else
+                    return _inline_ptr<double>(std::bit_cast<double>(bits_ - double_offset));
+            }
+        }
+
+        else if constexpr (std::same_as<Value, function>) {
+            // The function implementation is the object itself, so hand out a new handle onto it.
+            _object_base* object = get_object();
+            if (!object || object->type_index() != _value_index_v<function>)
+                return _inline_ptr<function>();
+
+            object->acquire();
+            return _inline_ptr<function>(function::adopt(object));
+        }
+
+        else {
+            const _object_base* object = get_object();
+            if (!object || object->type_index() != _value_index_v<Value>)
+                return static_cast<const Value*>(nullptr);
+
+            return &static_cast<const _boxed_object<Value>*>(object)->value_;
+        }
+    }
+
+    // See lox_string::append_if_unique.
+    constexpr bool append_if_unique(std::string_view suffix) {
+        _object_base* object = get_object();
+        if (!object || object->type_index() != _value_index_v<std::string> || !object->unique())
+            return false;
+
+        static_cast<_boxed_object<std::string>*>(object)->value_.append(suffix);
+        return true;
+    }
+
+    // The function object this value holds, if any, see heap_t::collect(). Like function::object(), this
+    // leaves out static objects.
+    [[nodiscard]] constexpr _object_base* function_object() const noexcept {
+        _object_base* object = get_object();
+        return object && object->type_index() == _value_index_v<function> && !object->is_static() ? object : nullptr;
+    }
+
+    constexpr bool operator==(const value_t& other) const noexcept {
+        const int i = index();
+        if (i != other.index())
+            return false;
+
+        switch (i) {
+        case _value_index_v<bool>:
+            return *get_if<bool>() == *other.get_if<bool>();
+        case _value_index_v<double>:
+            return *get_if<double>() == *other.get_if<double>();
+        case _value_index_v<std::string>:
+            return get_object() == other.get_object() || *get_if<std::string>() == *other.get_if<std::string>();
+        case _value_index_v<function>:
+            return *get_if<function>() == *other.get_if<function>();
+        default:
+            return true;
+        }
+    }
+
+private:
+    constexpr void set_nil() noexcept {
+        if consteval {
+            object_ = nullptr;
+        } else {
+            bits_ = nil_bits;
+        }
+    }
+
+    constexpr void set_object(_object_base* object) noexcept {
+        if consteval {
+            object_ = object;
+        } else {
+            bits_ = std::bit_cast<std::uint64_t>(object);
+        }
+    }
+
+    [[nodiscard]] constexpr _object_base* get_object() const noexcept {
+        if consteval {
+            return object_;
+        } else {
+            if (bits_ > true_bits && bits_ < double_offset)
+                return std::bit_cast<_object_base*>(bits_);
+            return nullptr;
+        }
+    }
+
+    [[nodiscard]] constexpr int index() const noexcept {
+        if consteval {
+            return object_ ? object_->type_index() : _value_index_v<nil_t>;
+        } else {
+            if (bits_ == nil_bits)
+                return _value_index_v<nil_t>;
+            if (bits_ == false_bits || bits_ == true_bits)
+                return _value_index_v<bool>;
+            if (bits_ >= double_offset)
+                return _value_index_v<double>;
+            return get_object()->type_index();
+        }
+    }
+};
+
+static_assert(sizeof(value_t) == 8);
+
+#else
+
 class value_t final {
-    using variant_t = std::variant<nil_t, bool, double, std::string, function>;
+    using variant_t = _value_variant_t;
+
+    template <typename Value>
+    using alternative_t = std::conditional_t<std::same_as<Value, std::string>, lox_string, Value>;
 
     variant_t value_;
 
 public:
     template <typename... Args>
         requires std::constructible_from<variant_t, Args&&...>
-    constexpr explicit(false) value_t(Args&&... args) noexcept  // NOLINT(*-explicit-constructor)
+    constexpr explicit(false) value_t(Args&&... args) noexcept(  // NOLINT(*-explicit-constructor)
+        std::is_nothrow_constructible_v<variant_t, Args&&...>)
         : value_(std::forward<Args>(args)...) { }
 
     constexpr value_t() noexcept = default;
@@ -26,24 +311,51 @@ public:
     constexpr value_t(value_t&&) noexcept = default;
     constexpr value_t& operator=(value_t&&) noexcept = default;
 
+    // Strings are visited as const std::string&, regardless of how they are stored.
     template <typename Visitor>
     constexpr auto visit(this auto&& self, Visitor&& v) {
-        return std::visit(std::forward<Visitor>(v), std::forward_like<decltype(self)>(self.value_));
+        return std::visit(
+            [&v]<typename T>(T&& value) {
+                if constexpr (std::same_as<std::remove_cvref_t<T>, lox_string>)
+                    return std::invoke(std::forward<Visitor>(v), value.get());
+                else
+                    return std::invoke(std::forward<Visitor>(v), std::forward<T>(value));
+            },
+            std::forward_like<decltype(self)>(self.value_));
     }
 
     template <typename Value>
     [[nodiscard]] constexpr bool holds() const noexcept {
-        return std::holds_alternative<Value>(value_);
+        return std::holds_alternative<alternative_t<Value>>(value_);
     }
 
     template <typename Value>
     [[nodiscard]] constexpr auto get_if(this auto&& self) noexcept {
-        return std::get_if<Value>(&std::forward_like<decltype(self)>(self.value_));
+        if constexpr (std::same_as<Value, std::string>) {
+            const lox_string* string = std::get_if<lox_string>(&self.value_);
+            return string ? &string->get() : nullptr;
+        } else {
+            return std::get_if<Value>(&std::forward_like<decltype(self)>(self.value_));
+        }
+    }
+
+    // See lox_string::append_if_unique.
+    constexpr bool append_if_unique(std::string_view suffix) {
+        lox_string* string = std::get_if<lox_string>(&value_);
+        return string && string->append_if_unique(suffix);
+    }
+
+    // The function object this value holds, if any, see heap_t::collect().
+    [[nodiscard]] constexpr _object_base* function_object() const noexcept {
+        const function* fn = std::get_if<function>(&value_);
+        return fn ? fn->object() : nullptr;
     }
 
     constexpr bool operator==(const value_t& other) const noexcept = default;
 };
 
+#endif
+
 }  // namespace ctlox::v2
 
 #include <ctlox/v2/function_impl.hpp>
\ No newline at end of file
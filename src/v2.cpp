@@ -1,7 +1,11 @@
 #include <ctlox/v2.hpp>
 
+#include <chrono>
 #include <iostream>
+#include <limits>
+#include <memory_resource>
 #include <print>
+#include <string_view>
 
 namespace ctlox_main::v2 {
 
@@ -117,32 +121,108 @@ list_2(println);
 
 )"_lox;
 
+constexpr auto cyclic_closures = R"(
+fun make_cycle() {
+    fun f() { return f; }
+    return f;
+}
+
+for (var i = 0; i < 100000; i = i + 1) make_cycle();
+)"_lox;
+
+void cyclic_closures_peak(std::string_view collection, const ctlox::v2::gc_options_t& gc) {
+    // The run's heap lives in an arena, which is freed at once when it goes out of scope.
+    std::pmr::monotonic_buffer_resource arena;
+    ctlox::v2::memory_stats_t stats;
+    const auto print_stats = [&] {
+        std::println("cyclic closures peak heap size {}: {}", collection, stats.peak_entries_);
+        if constexpr (ctlox::v2::memory_stats_enabled) {
+            std::println(
+                "creates: {}, releases: {}, frames: {}, function copies: {}",
+                stats.creates_,
+                stats.releases_,
+                stats.frames_,
+                stats.function_copies_);
+        }
+    };
+
+    // The counters are reported even if the program fails, so they're printed before the error is.
+    try {
+        cyclic_closures(
+            ctlox::v2::default_setup_fn {}, { .gc_ = gc, .memory_resource_ = &arena, .memory_stats_ = &stats });
+    } catch (const ctlox::v2::runtime_error&) {
+        print_stats();
+        throw;
+    }
+    print_stats();
+}
+
+// With CTLOX_STATS, prints the references a program took on strings and functions, see memory_stats_t.
+void print_copies(std::string_view name, const ctlox::v2::memory_stats_t& stats) {
+    if constexpr (ctlox::v2::memory_stats_enabled) {
+        std::println(
+            "{} copied strings {} times, functions {} times", name, stats.string_copies_, stats.function_copies_);
+    }
+}
+
 constexpr double fib_impl(double n) {
     if (n > 1)
         return fib_impl(n - 1) + fib_impl(n - 2);
     return n;
 }
 
-constexpr void fib_native() {
+std::chrono::duration<double> fib_native() {
     using double_time_point_t = std::chrono::time_point<std::chrono::system_clock, std::chrono::duration<double>>;
 
     std::println("-----");
     const double_time_point_t t0 = std::chrono::system_clock::now();
     std::println("{}", fib_impl(25));
-    std::println("native fibonacci took: {}", double_time_point_t(std::chrono::system_clock::now()) - t0);
+    const std::chrono::duration<double> took = double_time_point_t(std::chrono::system_clock::now()) - t0;
+    std::println("native fibonacci took: {}", took);
+    return took;
+}
+
+std::chrono::duration<double> fibonacci_timed(ctlox::v2::memory_stats_t& stats) {
+    using double_time_point_t = std::chrono::time_point<std::chrono::system_clock, std::chrono::duration<double>>;
+
+    const double_time_point_t t0 = std::chrono::system_clock::now();
+    fibonacci(ctlox::v2::default_setup_fn {}, { .memory_stats_ = &stats });
+    return double_time_point_t(std::chrono::system_clock::now()) - t0;
+}
+
+void poor_mans_list_timed() {
+    using double_time_point_t = std::chrono::time_point<std::chrono::system_clock, std::chrono::duration<double>>;
+
+    std::println("-----");
+    ctlox::v2::memory_stats_t stats;
+    const double_time_point_t t0 = std::chrono::system_clock::now();
+    poor_mans_list(ctlox::v2::default_setup_fn {}, { .memory_stats_ = &stats });
+    std::println("poor man's list took: {}", double_time_point_t(std::chrono::system_clock::now()) - t0);
+    print_copies("poor man's list", stats);
 }
 
 int main() try {
 
+    // Tells the outputs of the std::variant and NaN-boxed builds apart, for comparing their timings.
+    std::println("value_t takes {} bytes.", sizeof(ctlox::v2::value_t));
+
     constexpr int prints = count_prints();
     std::print("program prints {} times.\n\n", prints);
 
-    program();
+    ctlox::v2::memory_stats_t stats;
+    program(ctlox::v2::default_setup_fn {}, { .memory_stats_ = &stats });
+    print_copies("program", stats);
+
+    const std::chrono::duration<double> lox_fib = fibonacci_timed(stats);
+    print_copies("fibonacci", stats);
+    const std::chrono::duration<double> native_fib = fib_native();
+    std::println("lox fibonacci is {:.1f} times slower than native", lox_fib / native_fib);
 
-    fibonacci();
-    fib_native();
+    poor_mans_list_timed();
 
-    poor_mans_list();
+    std::println("-----");
+    cyclic_closures_peak("without collection", { .threshold_ = std::numeric_limits<std::size_t>::max() });
+    cyclic_closures_peak("with collection", {});
 
     return 0;
 } catch (const ctlox::v2::runtime_error& e) {
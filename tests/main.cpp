@@ -1,5 +1,15 @@
+namespace test_v2::test_allocations {
+void run();
+}
+
+namespace test_v2::test_code_generator {
+void run();
+}
+
 int main()
 {
-    // if the tests compiled, then they passed!
+    // if the tests compiled, then they passed! Except for those which only exercise runtime code paths.
+    test_v2::test_allocations::run();
+    test_v2::test_code_generator::run();
     return 0;
 }
\ No newline at end of file
@@ -0,0 +1,157 @@
+#include "framework.hpp"
+
+#include <ctlox/v2.hpp>
+
+#include <array>
+#include <cstddef>
+#include <cstdlib>
+#include <memory_resource>
+#include <new>
+#include <string>
+#include <string_view>
+
+// Allocations made through the default allocator, counted by replacing the global operator new. These
+// tests measure runtime allocations, so unlike the others, they have to run (see main.cpp).
+namespace {
+std::size_t default_allocations = 0;
+}
+
+void* operator new(std::size_t size) {
+    ++default_allocations;
+    if (void* p = std::malloc(size == 0 ? 1 : size)) {
+        return p;
+    }
+    throw std::bad_alloc();
+}
+
+void operator delete(void* p) noexcept { std::free(p); }
+
+void operator delete(void* p, std::size_t) noexcept { std::free(p); }
+
+namespace test_v2::test_allocations {
+
+using namespace ctlox::v2::literals;
+using namespace std::string_literals;
+
+// Counts the allocations of a program, which it serves from a fixed buffer.
+class counting_resource final : public std::pmr::memory_resource {
+public:
+    std::size_t allocations_ = 0;
+
+private:
+    void* do_allocate(std::size_t bytes, std::size_t alignment) override {
+        ++allocations_;
+        return buffer_.allocate(bytes, alignment);
+    }
+
+    void do_deallocate(void* p, std::size_t bytes, std::size_t alignment) override {
+        buffer_.deallocate(p, bytes, alignment);
+    }
+
+    bool do_is_equal(const memory_resource& other) const noexcept override { return this == &other; }
+
+    alignas(std::max_align_t) std::array<std::byte, 1 << 20> storage_;
+    std::pmr::monotonic_buffer_resource buffer_ { storage_.data(), storage_.size(), std::pmr::null_memory_resource() };
+};
+
+constexpr auto strings_closures_and_cycles = R"(
+var greeting = "hi";
+fun make_counter() {
+    var count = 0;
+    fun increment() {
+        count = count + 1;
+        return count;
+    }
+    return increment;
+}
+var counter = make_counter();
+counter();
+print counter();
+print greeting + "!";
+
+fun make_cycle() {
+    fun f() { return f; }
+    return f;
+}
+for (var i = 0; i < 10; i = i + 1) make_cycle();
+)"_lox;
+
+// Strings, closures, captured variables and globals all come from the program's memory resource.
+void test_memory_resource() {
+    static counting_resource resource;
+    std::array<ctlox::v2::value_t, 2> output;
+    std::size_t printed = 0;
+
+    const std::size_t allocations_before = default_allocations;
+    strings_closures_and_cycles(
+        [&](ctlox::v2::environment* env) {
+            env->define_native<1>("println", [&](const ctlox::v2::value_t& value) { output.at(printed++) = value; });
+        },
+        { .memory_resource_ = &resource });
+    const std::size_t allocations_after = default_allocations;
+
+    expect_equal(allocations_after, allocations_before);
+    expect(resource.allocations_ > 0);
+    expect_equal(printed, std::size_t(2));
+    expect_equal(output[0], ctlox::v2::value_t(2.0));
+    expect_equal(output[1], ctlox::v2::value_t("hi!"s));
+}
+
+// Natives whose name is known at compile time are static objects, so defining them and copying them around,
+// as functions or as values, never allocates.
+void test_static_natives() {
+    static constexpr std::array<std::string_view, 1> names { "println" };
+    ctlox::v2::environment globals;
+    globals.declare_globals(names);
+
+    const std::size_t allocations_before = default_allocations;
+    globals.define_native<1, "println">(ctlox::v2::default_println_fn {});
+    const ctlox::v2::function println =
+        ctlox::v2::make_native_function<1, "println">(ctlox::v2::default_println_fn {});
+    const ctlox::v2::function println_copy = println;
+    const ctlox::v2::value_t value = println_copy;
+    const ctlox::v2::value_t value_copy = value;
+    const std::size_t allocations_after = default_allocations;
+
+    expect_equal(allocations_after, allocations_before);
+    expect(value_copy == ctlox::v2::value_t(println));
+    expect_equal(println_copy.name(), "println"s);
+    expect_equal(println_copy.arity(), 1);
+}
+
+constexpr auto borrowed_reads = R"(
+var s = "x";
+fun g() { }
+var f = g;
+var n = 0;
+for (var i = 0; i < 100; i = i + 1) {
+    if (s == "x" and f != nil) n = n + 1;
+}
+print n;
+)"_lox;
+
+// Variables which are only inspected are read by reference, so reading them takes no reference on the
+// strings and functions they hold. Copying them would take at least one per iteration.
+void test_borrowed_reads() {
+    if constexpr (ctlox::v2::memory_stats_enabled) {
+        ctlox::v2::value_t output;
+        ctlox::v2::memory_stats_t stats;
+        borrowed_reads(
+            [&](ctlox::v2::environment* env) {
+                env->define_native<1>("println", [&](const ctlox::v2::value_t& value) { output = value; });
+            },
+            { .memory_stats_ = &stats });
+
+        expect_equal(output, ctlox::v2::value_t(100.0));
+        expect(stats.string_copies_ < 100);
+        expect(stats.function_copies_ < 100);
+    }
+}
+
+void run() {
+    test_memory_resource();
+    test_static_natives();
+    test_borrowed_reads();
+}
+
+}  // namespace test_v2::test_allocations
\ No newline at end of file
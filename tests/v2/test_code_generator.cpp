@@ -1,21 +1,35 @@
 #include <ctlox/v2/code_generator.hpp>
 
 #include <ctlox/common/string.hpp>
+#include <ctlox/v2/folder.hpp>
 #include <ctlox/v2/parser.hpp>
+#include <ctlox/v2/pruner.hpp>
 #include <ctlox/v2/resolver.hpp>
 #include <ctlox/v2/scanner.hpp>
 #include <ctlox/v2/serializer.hpp>
 
+#include <algorithm>
+#include <limits>
+#include <string_view>
+
 #include "framework.hpp"
 
 namespace test_v2::test_code_generator {
 
+// The AST and bindings the code of source is generated from.
 template <ctlox::string source>
-constexpr auto generate_code_for() {
-    constexpr auto generate_ast = [] { return ctlox::v2::parse(ctlox::v2::scan(source)); };
-    static constexpr auto ast = ctlox::v2::static_serialize<generate_ast>();
+struct compiled {
+    static constexpr auto generate_ast = [] { return ctlox::v2::parse(ctlox::v2::scan(source)); };
+    static constexpr auto serialized_ast = ctlox::v2::static_serialize<generate_ast>();
+    static_assert(ctlox::v2::static_check<serialized_ast>());
+    static constexpr auto folded_ast = ctlox::v2::static_fold<serialized_ast>();
+    static constexpr auto ast = ctlox::v2::static_prune<folded_ast>();
     static constexpr auto locals = ctlox::v2::static_resolve<ast>();
-    return ctlox::v2::generate_code<ast, locals>();
+};
+
+template <ctlox::string source>
+constexpr auto generate_code_for() {
+    return ctlox::v2::generate_code<compiled<source>::ast, compiled<source>::locals>();
 }
 
 template <ctlox::string source>
@@ -95,6 +109,53 @@ static_assert(test_program<R"(
 0;                                                                                               // 257
 )">({}));
 
+static_assert(test_program<R"(
+var s = "a";
+var t = s;
+s = s + "b";
+print s;
+print t;
+for (var i = 0; i < 3; i = i + 1) s = s + "c";
+print s;
+s = s + s;
+print s;
+{
+    var u = "x";
+    u = u + "y" + "z";
+    print u;
+}
+)">({ "ab"s, "a"s, "abccc"s, "abcccabccc"s, "xyz"s }));
+
+// Interned string literals are never appended to in place
+static_assert(test_program<R"(
+for (var i = 0; i < 2; i = i + 1) {
+    var s = "a";
+    s = s + "b";
+    print s;
+}
+print "a" == "a";
+)">({ "ab"s, "ab"s, true }));
+
+// Operands are only read by reference when nothing evaluated after them can reassign them
+static_assert(test_program<R"(
+var a = 1;
+print a + (a = 2);
+var b = "x";
+fun f() { b = "y"; return "z"; }
+print b + f();
+print b == b;
+)">({ 3.0, "xz"s, true }));
+
+// Globals are accessed by index, including ones defined after they are first referred to
+static_assert(test_program<R"(
+fun f() { return g(); }
+fun g() { return "g"; }
+print f();
+var a = 1;
+var a = a + 1;
+print a;
+)">({ "g"s, 2.0 }));
+
 static_assert(test_program<R"(
 var b = 0;
 while (b < 4) {
@@ -221,4 +282,530 @@ var in = mid();
 in();
 )">({ "return from outer", "create inner closure", "value" }));
 
+// Captured and plain variables, including parameters, are numbered separately
+static_assert(test_program<R"(
+fun counter(start, step) {
+  var plain = "plain";
+  var count = start;
+  fun next() {
+    count = count + step;
+    return count;
+  }
+  print plain;
+  return next;
+}
+
+var next = counter(1, 2);
+print next();
+print next();
+)">({ "plain"s, 3., 5. }));
+
+// Copies of a function share its closure: they compare equal, and see each other's assignments
+static_assert(test_program<R"(
+fun counter() {
+  var n = 0;
+  fun inc() { n = n + 1; return n; }
+  return inc;
+}
+fun identity(f) { return f; }
+
+var a = counter();
+var b = a;
+print a == b;
+a();
+print b();
+print identity(a) == b;
+print identity(b)();
+print a();
+print a == counter();
+)">({ true, 2., true, 3., 4., false }));
+
+// Blocks which declare nothing don't count towards a variable's depth
+static_assert(test_program<R"(
+fun f() {
+  var a = "a";
+  {
+    var b = "b";
+    {
+      {
+        print a + b;
+      }
+      b = a;
+    }
+    print b;
+  }
+}
+f();
+)">({ "ab"s, "a"s }));
+
+// Variables declared several blocks out, in frames of their own, are read and assigned through the display
+static_assert(test_program<R"(
+fun outer(p) {
+  var a = "a";
+  for (var i = 0; i < 2; i = i + 1) {
+    var b = "b";
+    {
+      var c = "c";
+      while (i < 1) {
+        var d = "d";
+        fun show() {
+          print p + a + b + c + d;
+          c = c + "?";
+        }
+        show();
+        {
+          var e = "e";
+          print p + a + b + c + d + e;
+          a = a + "!";
+          i = i + 1;
+        }
+      }
+      print a + c;
+    }
+  }
+  fun inner() {
+    var x = "x";
+    {
+      var y = "y";
+      {
+        print p + a + x + y;
+      }
+    }
+  }
+  inner();
+}
+outer("p");
+)">({ "pabcd"s, "pabc?de"s, "a!c?"s, "pa!xy"s }));
+
+// Blocks in a function share its frame, with a fresh variable on every entry
+static_assert(test_program<R"(
+var first;
+var second;
+fun f() {
+  var a = "outer";
+  for (var i = 0; i < 2; i = i + 1) {
+    var a = i;
+    {
+      var b = a + 10;
+      fun get() { return b; }
+      if (first == nil) first = get; else second = get;
+    }
+    print a;
+  }
+  print a;
+}
+f();
+print first();
+print second();
+)">({ 0., 1., "outer"s, 10., 11. }));
+
+// Functions which are only called directly borrow the variables they capture,
+// unless they're called from a function which escapes
+static_assert(test_program<R"(
+fun f() {
+  var a = 1;
+  var calls = 0;
+  fun add(n) { a = a + n; return a; }
+  fun twice(n) { calls = calls + 1; add(n); return add(n); }
+  fun get() { return add(0); }
+  print twice(2);
+  print twice(1);
+  print calls;
+  return get;
+}
+print f()();
+
+fun g() {
+  var x = 1;
+  fun outer() {
+    fun inner() { x = x + 1; }
+    inner();
+    inner();
+  }
+  outer();
+  print x;
+}
+g();
+)">({ 5., 7., 2., 7., 3. }));
+
+// Cycles between closures and the variables they capture are collected
+constexpr bool test_collect_cycles() {
+    auto program = generate_code_for<R"(
+fun make() {
+  fun f() { return f; }
+  return f;
+}
+for (var i = 0; i < 10; i = i + 1) make();
+var kept = make();
+println(heap_size());
+collect();
+println(heap_size());
+print kept == kept();
+)">();
+
+    std::vector<ctlox::v2::value_t> output;
+    auto print_fn = [&output](ctlox::v2::value_t value) { output.push_back(std::move(value)); };
+    program([&print_fn](ctlox::v2::environment* env) {
+        env->define_native<1>("println", print_fn);
+        env->define_native<0>("heap_size", [](const ctlox::v2::program_state_t& state) {
+            return static_cast<double>(state.heap_->size());
+        });
+        env->define_native<0>("collect", [](const ctlox::v2::program_state_t& state) { state.heap_->collect(); });
+    });
+
+    expect_equal(output.size(), std::size_t { 3 });
+    expect_equal(output[0], 11.0);
+    expect_equal(output[1], 1.0);
+    expect_equal(output[2], true);
+    return true;
+}
+static_assert(test_collect_cycles());
+
+// Incremental collection runs in slices on allocation, and doesn't free anything reachable
+constexpr bool test_incremental_collection() {
+    auto program = generate_code_for<R"(
+fun make() {
+  fun f() { return f; }
+  return f;
+}
+fun counter() {
+  var n = 0;
+  fun inc() { n = n + 1; return n; }
+  return inc;
+}
+var c = counter();
+for (var i = 0; i < 50; i = i + 1) {
+  make();
+  c();
+}
+print c();
+collect();
+print heap_size();
+)">();
+
+    std::vector<ctlox::v2::value_t> output;
+    auto print_fn = [&output](ctlox::v2::value_t value) { output.push_back(std::move(value)); };
+    ctlox::v2::gc_stats_t stats;
+    program(
+        [&print_fn](ctlox::v2::environment* env) {
+            env->define_native<1>("println", print_fn);
+            env->define_native<0>("heap_size", [](const ctlox::v2::program_state_t& state) {
+                return static_cast<double>(state.heap_->size());
+            });
+            env->define_native<0>("collect", [](const ctlox::v2::program_state_t& state) { state.heap_->collect(); });
+        },
+        { .gc_ = { .threshold_ = 8, .slice_budget_ = 16 }, .gc_stats_ = &stats });
+
+    expect_equal(output.size(), std::size_t { 2 });
+    expect_equal(output[0], 51.0);
+    expect_equal(output[1], 1.0);
+    expect(stats.collections_ > 1 && stats.slices_ > stats.collections_);
+    return true;
+}
+static_assert(test_incremental_collection());
+
+// Only trial deletion exceeds the slice budget: the large cycle it finds is freed over several slices
+constexpr bool test_incremental_release() {
+    auto program = generate_code_for<R"(
+fun make_ring() {
+  var ring;
+  var node;
+  for (var i = 0; i < 200; i = i + 1) {
+    var next = node;
+    fun f() { return ring or next; }
+    node = f;
+  }
+  ring = node;
+}
+fun make() {
+  fun f() { return f; }
+  return f;
+}
+make_ring();
+for (var i = 0; i < 1000; i = i + 1) make();
+)">();
+
+    ctlox::v2::gc_stats_t stats;
+    program(ctlox::v2::default_setup_fn {}, { .gc_ = { .threshold_ = 8, .slice_budget_ = 16 }, .gc_stats_ = &stats });
+
+    expect(stats.freed_ >= 201);
+    expect(stats.longest_trial_deletion_work_ >= 201);
+    expect(stats.longest_pause_work_ <= 16 + stats.longest_trial_deletion_work_);
+    return true;
+}
+static_assert(test_incremental_release());
+
+// The heap's sizes are reported once the program ends
+constexpr bool test_memory_stats() {
+    auto program = generate_code_for<R"(
+fun counter() {
+  var n = 0;
+  fun inc() { n = n + 1; return n; }
+  return inc;
+}
+var a = counter();
+var b = counter();
+a();
+b = nil;
+)">();
+
+    ctlox::v2::memory_stats_t stats;
+    program(ctlox::v2::default_setup_fn {}, { .memory_stats_ = &stats });
+
+    expect_equal(stats.live_entries_, std::size_t { 1 });
+    expect_equal(stats.peak_entries_, std::size_t { 2 });
+    expect_equal(stats.free_entries_, std::size_t { 1 });
+    return true;
+}
+static_assert(test_memory_stats());
+
+// Growing the heap by more than a chunk of entries doesn't move the values it already holds
+constexpr bool test_stable_heap_entries() {
+    ctlox::v2::heap_t heap(ctlox::v2::gc_options_t {});
+    const ctlox::v2::shared_value_t first = heap.create(ctlox::v2::value_t("first"s));
+    const ctlox::v2::value_t& held = first.get();
+
+    std::vector<ctlox::v2::shared_value_t> entries;
+    for (int i = 0; i < 600; ++i) {
+        entries.push_back(heap.create(ctlox::v2::value_t(static_cast<double>(i))));
+    }
+
+    expect(&first.get() == &held);
+    expect_equal(held, ctlox::v2::value_t("first"s));
+    expect_equal(entries[299].get(), ctlox::v2::value_t(299.0));
+    expect_equal(heap.size(), std::size_t { 601 });
+    return true;
+}
+static_assert(test_stable_heap_entries());
+
+// Collecting cycles bounds the heap's peak by its threshold, where every cycle would otherwise stay alive
+constexpr bool test_cyclic_closures_peak() {
+    auto program = generate_code_for<R"(
+fun make_cycle() {
+  fun f() { return f; }
+  return f;
+}
+for (var i = 0; i < 200; i = i + 1) make_cycle();
+)">();
+
+    ctlox::v2::memory_stats_t collected;
+    program(ctlox::v2::default_setup_fn {}, { .gc_ = { .threshold_ = 16 }, .memory_stats_ = &collected });
+    ctlox::v2::memory_stats_t uncollected;
+    program(ctlox::v2::default_setup_fn {},
+        { .gc_ = { .threshold_ = std::numeric_limits<std::size_t>::max() }, .memory_stats_ = &uncollected });
+
+    expect(collected.peak_entries_ <= 16);
+    expect_equal(uncollected.peak_entries_, std::size_t { 200 });
+    return true;
+}
+static_assert(test_cyclic_closures_peak());
+
+// Folded expressions evaluate to the same values, and short-circuited operands are never evaluated
+static_assert(test_program<R"(
+var y = "y";
+print 0.1 + 0.2;
+print -(1 - 3) * 2 >= 4;
+print false or y;
+print nil and undefined();
+print "a" + "b" == "ab";
+)">({ 0.1 + 0.2, true, "y"s, ctlox::v2::nil, true }));
+
+// Pruned branches and unreachable statements don't run
+static_assert(test_program<R"(
+fun f(x) {
+  if (true) return x;
+  print "unreachable";
+}
+if (1 > 2) print "zim"; else print "zam";
+while (false) print "never";
+for (var i = 0; i < 3; i = i + 1) {
+  print f(i);
+  break;
+  print "never";
+}
+)">({ "zam"s, 0.0 }));
+
+// Numbers proven by type inference evaluate unboxed, and operands which aren't proven are still checked
+static_assert(test_program<R"(
+{
+    fun fib(n) {
+        if (n > 1) return fib(n - 1) + fib(n - 2);
+        return n;
+    }
+    fun twice(x) { return x + x; }
+    var i = 0;
+    while (i < 3) i = i + 1;
+    print fib(10);
+    print -i * (i - 1) / 2;
+    print twice(i) <= 6;
+    print twice("s");
+}
+)">({ 55.0, -3.0, true, "ss"s }));
+
+// Counted loops, and loops which look like them but reassign or capture their counter
+static_assert(test_program<R"(
+var sum = 0;
+for (var i = 0; i < 4; i = i + 1) {
+  for (var j = 3; j >= i; j = j - 1) sum = sum + j;
+  if (i == 2) break;
+}
+print sum;
+for (var i = 0; i < 10; i = i + 3) {
+  if (i == 3) i = 7;
+  print i;
+}
+var f;
+for (var i = 0; i <= 1; i = i + 0.5) {
+  fun g() { return i; }
+  f = g;
+}
+print f();
+var k = 5;
+{
+  var n = 1;
+  while (n < 100) n = n + n;
+  print n;
+}
+print k = k - 1;
+)">({ 17.0, 0.0, 7.0, 1.5, 128.0, 4.0 }));
+
+// A function which borrows the counter may assign to it while the loop runs
+static_assert(test_program<R"(
+{
+  var i = 0;
+  fun skip() { i = i + 5; }
+  while (i < 10) {
+    skip();
+    i = i + 1;
+  }
+  print i;
+}
+)">({ 12.0 }));
+
+// Direct calls to local functions, and calls to local functions which are reassigned
+static_assert(test_program<R"(
+{
+  fun add(a, b) { return a + b; }
+  fun fib(n) {
+    if (n < 2) return n;
+    return fib(n - 1) + fib(n - 2);
+  }
+  fun three() { return add(1, 2); }
+  fun never() { return add(1); }
+  fun h() { return "h"; }
+  var g = h;
+  print add("a", "b");
+  print fib(10);
+  print three();
+  print g();
+  h = add;
+  print h(2, 3);
+}
+)">({ "ab"s, 55.0, 3.0, "h"s, 5.0 }));
+
+constexpr ctlox::string recursive_fib = R"(
+{
+  fun fib(n) {
+    if (n < 2) return n;
+    return fib(n - 1) + fib(n - 2);
+  }
+  print fib(10);
+}
+)";
+
+// fib's calls to itself are recursive direct calls, which call it through recursive_call_fn at runtime
+static_assert([] {
+    constexpr const auto& direct_calls = compiled<recursive_fib>::locals.direct_calls_;
+    expect_equal(direct_calls.size(), 3uz);
+    expect(std::ranges::all_of(direct_calls, [&](const auto& call) {
+        return call.function_ == direct_calls[0].function_;
+    }));
+    expect_equal(std::ranges::count_if(direct_calls, &ctlox::v2::direct_call_t::recursive_), 2);
+    return true;
+}());
+
+static_assert(test_program<recursive_fib>({ 55.0 }));
+
+// Errors can only be caught at runtime: source has a static error in code which folding or pruning removes,
+// which static_check finds before either, as compiled does.
+template <ctlox::string source>
+void expect_static_error_in_pruned_code() {
+    static constexpr auto generate_ast = [] { return ctlox::v2::parse(ctlox::v2::scan(source)); };
+    static constexpr auto serialized_ast = ctlox::v2::static_serialize<generate_ast>();
+    static constexpr auto folded_ast = ctlox::v2::static_fold<serialized_ast>();
+    static constexpr auto ast = ctlox::v2::static_prune<folded_ast>();
+
+    static_cast<void>(ctlox::v2::resolve<ast>());
+    try {
+        ctlox::v2::static_check<serialized_ast>();
+    } catch (const ctlox::v2::parse_error&) {
+        return;
+    }
+    fail_with("expected a static error");
+}
+
+// A direct call with the wrong number of arguments is only known to fail when it's compiled, but it still
+// evaluates its arguments before it throws.
+void test_direct_call_arity() {
+    auto program = generate_code_for<R"(
+{
+  fun add(a, b) { return a + b; }
+  fun argument(n) { println(n); return n; }
+  println(add(1, 2));
+  add(argument(4));
+  println("unreachable");
+}
+)">();
+
+    std::vector<ctlox::v2::value_t> output;
+    auto print_fn = [&output](ctlox::v2::value_t value) { output.push_back(std::move(value)); };
+    try {
+        program([&print_fn](ctlox::v2::environment* env) { env->define_native<1>("println", print_fn); });
+    } catch (const ctlox::v2::runtime_error& e) {
+        expect_equal(std::string_view(e.what()), std::string_view("Incorrect argument count."));
+        expect_equal(output.size(), std::size_t { 2 });
+        expect_equal(output[0], ctlox::v2::value_t(3.0));
+        expect_equal(output[1], ctlox::v2::value_t(4.0));
+        return;
+    }
+    fail_with("expected a runtime error");
+}
+
+// A program which fails at runtime still reports its memory counters, up to its error.
+void test_memory_stats_on_error() {
+    auto program = generate_code_for<R"(
+fun counter() {
+  var n = 0;
+  fun inc() { n = n + 1; return n; }
+  return inc;
+}
+fun negate(x) { return -x; }
+var a = counter();
+a();
+negate("not a number");
+)">();
+
+    ctlox::v2::memory_stats_t stats;
+    try {
+        program(ctlox::v2::default_setup_fn {}, { .memory_stats_ = &stats });
+    } catch (const ctlox::v2::runtime_error&) {
+        expect_equal(stats.live_entries_, std::size_t { 1 });
+        expect_equal(stats.peak_entries_, std::size_t { 1 });
+        return;
+    }
+    fail_with("expected a runtime error");
+}
+
+void run() {
+    // Recursive direct calls only go through recursive_call_fn at runtime, see main.cpp
+    expect(test_program<recursive_fib>({ 55.0 }));
+
+    expect_static_error_in_pruned_code<"if (false) { var a = 1; var a = 2; }">();
+    expect_static_error_in_pruned_code<"while (false) { var x = x; }">();
+    expect_static_error_in_pruned_code<"{ var a = false and a; }">();
+
+    test_direct_call_arity();
+    test_memory_stats_on_error();
+}
+
 }  // namespace test_v2::test_code_generator
\ No newline at end of file
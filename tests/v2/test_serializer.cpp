@@ -1,12 +1,17 @@
 #include "framework.hpp"
 
+#include <ctlox/v2/constant_pool.hpp>
+#include <ctlox/v2/folder.hpp>
 #include <ctlox/v2/parser.hpp>
+#include <ctlox/v2/pruner.hpp>
 #include <ctlox/v2/scanner.hpp>
 #include <ctlox/v2/serializer.hpp>
+#include <ctlox/v2/type_inference.hpp>
 
 #include <ranges>
 #include <span>
 #include <string_view>
+#include <vector>
 
 namespace test_v2::test_serializer {
 
@@ -41,6 +46,12 @@ constexpr auto block_stmt(auto... check_statements) {
     };
 }
 
+constexpr auto break_stmt() {
+    return [](const auto& ast, ctlox::v2::flat_stmt_ptr node_ptr) {
+        expect_holds<ctlox::v2::flat_break_stmt>(ast, node_ptr);
+    };
+}
+
 constexpr auto expression_stmt(auto check_expression) {
     return [=](const auto& ast, ctlox::v2::flat_stmt_ptr node_ptr) {
         const auto& expression_stmt = expect_holds<ctlox::v2::flat_expression_stmt>(ast, node_ptr);
@@ -295,4 +306,143 @@ while (nil or foo) {
     static_assert((check_3(ast, ast.root_block_[3]), true));
 }  // namespace test_static_serialize
 
+namespace test_static_fold {
+    constexpr auto source = R"(
+var foo = (12 + 13) / 2;
+print !nil == true;
+print nil or foo;
+print false and foo();
+print "Hello, " + "world!";
+print ("a" + "b") + ("c" + "" + "d") == "abcd";
+)";
+
+    constexpr ctlox::v2::ast_generator auto gen = [] { return ctlox::v2::parse(ctlox::v2::scan(source)); };
+    constexpr auto serialized_ast = ctlox::v2::static_serialize<gen>();
+    constexpr auto ast = ctlox::v2::static_fold<serialized_ast>();
+
+    // clang-format off
+    constexpr auto check_0 =
+        var_stmt("foo",
+            literal_expr(12.5));
+    constexpr auto check_1 =
+        print_stmt(
+            literal_expr(true));
+    constexpr auto check_2 =
+        print_stmt(
+            grouping_expr(
+                variable_expr("foo")));
+    constexpr auto check_3 =
+        print_stmt(
+            literal_expr(false));
+    constexpr auto check_4 =
+        print_stmt(
+            literal_expr("Hello, world!"));
+    constexpr auto check_5 =
+        print_stmt(
+            literal_expr(true));
+    // clang-format on
+
+    static_assert((check_0(ast, ast.root_block_[0]), true));
+    static_assert((check_1(ast, ast.root_block_[1]), true));
+    static_assert((check_2(ast, ast.root_block_[2]), true));
+    static_assert((check_3(ast, ast.root_block_[3]), true));
+    static_assert((check_4(ast, ast.root_block_[4]), true));
+    static_assert((check_5(ast, ast.root_block_[5]), true));
+
+    // Concatenations are folded into strings of their own, which are constants like any other string literal.
+    static_assert(ctlox::v2::collect_constants<ast>().strings_ == std::vector<std::string_view> { "Hello, world!" });
+}  // namespace test_static_fold
+
+namespace test_static_prune {
+    constexpr auto source = R"(
+if (1 > 2) print "zim"; else print "zam";
+if (nil) print "never";
+while (false) print "never";
+while (true) {
+    print "once";
+    break;
+    print "never";
+}
+)";
+
+    constexpr ctlox::v2::ast_generator auto gen = [] { return ctlox::v2::parse(ctlox::v2::scan(source)); };
+    constexpr auto serialized_ast = ctlox::v2::static_serialize<gen>();
+    constexpr auto folded_ast = ctlox::v2::static_fold<serialized_ast>();
+    constexpr auto ast = ctlox::v2::static_prune<folded_ast>();
+
+    // clang-format off
+    constexpr auto check_0 =
+        print_stmt(
+            literal_expr("zam"));
+    constexpr auto check_1 =
+        block_stmt();
+    constexpr auto check_2 =
+        block_stmt();
+    constexpr auto check_3 =
+        while_stmt(
+            literal_expr(true),
+            block_stmt(
+                print_stmt(literal_expr("once")),
+                break_stmt()));
+    // clang-format on
+
+    static_assert((check_0(ast, ast.root_block_[0]), true));
+    static_assert((check_1(ast, ast.root_block_[1]), true));
+    static_assert((check_2(ast, ast.root_block_[2]), true));
+    static_assert((check_3(ast, ast.root_block_[3]), true));
+
+    // Pruned statements no longer refer to any string literal.
+    static_assert(ctlox::v2::collect_constants<ast>().size() == 2);
+}  // namespace test_static_prune
+
+namespace test_infer_types {
+    constexpr auto source = R"(
+{
+    fun fib(n) {
+        if (n > 1) return fib(n - 1) + fib(n - 2);
+        return n;
+    }
+    fun id(x) { return x; }
+    var f = id;
+    var i = 0;
+    i = i + fib(3);
+    print id(i);
+}
+)";
+
+    constexpr ctlox::v2::ast_generator auto gen = [] { return ctlox::v2::parse(ctlox::v2::scan(source)); };
+    constexpr auto ast = ctlox::v2::static_serialize<gen>();
+    constexpr auto types = ctlox::v2::static_infer_types<ast>();
+
+    using ctlox::v2::flat_block_stmt;
+    using ctlox::v2::flat_call_expr;
+    using ctlox::v2::flat_function_stmt;
+    using ctlox::v2::flat_if_stmt;
+    using ctlox::v2::flat_return_stmt;
+    using ctlox::v2::flat_var_stmt;
+    using ctlox::v2::static_type_t;
+
+    constexpr ctlox::v2::flat_stmt_list block = expect_holds<flat_block_stmt>(ast, ast.root_block_[0]).statements_;
+
+    // fib is only ever called with numbers, so n is a number, and so is everything fib returns.
+    constexpr const flat_function_stmt& fib = expect_holds<flat_function_stmt>(ast, block[0]);
+    constexpr const flat_if_stmt& fib_if = expect_holds<flat_if_stmt>(ast, fib.body_[0]);
+    static_assert(types.type_of(fib_if.condition_) == static_type_t::boolean);
+    static_assert(types.is_number(expect_holds<flat_return_stmt>(ast, fib_if.then_branch_).value_));
+    static_assert(types.is_number(expect_holds<flat_return_stmt>(ast, fib.body_[1]).value_));
+
+    // id is read as a value, so it may be called with anything.
+    constexpr const flat_function_stmt& id = expect_holds<flat_function_stmt>(ast, block[1]);
+    static_assert(types.type_of(expect_holds<flat_return_stmt>(ast, id.body_[0]).value_) == static_type_t::unknown);
+
+    constexpr const flat_var_stmt& i = expect_holds<flat_var_stmt>(ast, block[3]);
+    static_assert(types.is_number(i.initializer_));
+
+    constexpr const flat_call_expr& print = expect_holds<flat_call_expr>(
+        ast, expect_holds<ctlox::v2::flat_expression_stmt>(ast, block[5]).expression_);
+    constexpr const flat_call_expr& call_id = expect_holds<flat_call_expr>(ast, print.arguments_[0]);
+    static_assert(types.type_of(print.arguments_[0]) == static_type_t::unknown);
+    static_assert(types.is_number(call_id.arguments_[0]));
+}  // namespace test_infer_types
+
 }  // namespace test_v2::test_serializer
\ No newline at end of file